@@ -0,0 +1,339 @@
+// audio_interleave.c
+// planar -> packed音频交织，说明见audio_interleave.h
+
+#include "audio_interleave.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#else
+#define HAVE_SSE2 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#else
+#define HAVE_NEON 0
+#endif
+
+void audio_interleave_memcpy(uint8_t *dst, const uint8_t *const *src, int sample_size, int nb_channels,
+                             int nb_samples)
+{
+    int i, ch;
+
+    for (i = 0; i < nb_samples; i++)
+    {
+        for (ch = 0; ch < nb_channels; ch++)
+        {
+            memcpy(dst, src[ch] + sample_size * i, sample_size);
+            dst += sample_size;
+        }
+    }
+}
+
+// 从第start个样本开始的标量循环。nb_channels是常数时编译器会展开内层循环
+#define DEFINE_INTERLEAVE_C(type)                                                                        \
+    static inline void interleave_##type(type *dst, const uint8_t *const *src, int nb_channels, int start, \
+                                         int nb_samples)                                                 \
+    {                                                                                                    \
+        int i, ch;                                                                                       \
+                                                                                                         \
+        for (i = start; i < nb_samples; i++)                                                             \
+            for (ch = 0; ch < nb_channels; ch++)                                                         \
+                dst[i * nb_channels + ch] = ((const type *)src[ch])[i];                                  \
+    }
+
+DEFINE_INTERLEAVE_C(uint8_t)
+DEFINE_INTERLEAVE_C(uint16_t)
+DEFINE_INTERLEAVE_C(uint32_t)
+DEFINE_INTERLEAVE_C(uint64_t)
+
+#if HAVE_SSE2
+
+// 下面的SIMD内核都只搬数据不做运算，float按32位整数处理，结果逐位一致。返回处理完的样本数，剩下的交给标量循环
+
+static inline __m128i load(const uint8_t *p, int i, int sample_size)
+{
+    return _mm_loadu_si128((const __m128i *)(p + i * sample_size));
+}
+
+// 4个声道 x 4个32位样本的转置：r[k]是第k个样本的4个声道
+static inline void transpose_4x4_32(__m128i a, __m128i b, __m128i c, __m128i d, __m128i r[4])
+{
+    __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d);
+    __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d);
+
+    r[0] = _mm_unpacklo_epi64(t0, t1);
+    r[1] = _mm_unpackhi_epi64(t0, t1);
+    r[2] = _mm_unpacklo_epi64(t2, t3);
+    r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+static int interleave_32_2ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    __m128i *d = (__m128i *)dst;
+    int i;
+
+    for (i = 0; i + 4 <= nb_samples; i += 4)
+    {
+        __m128i l = load(src[0], i, 4), r = load(src[1], i, 4);
+        _mm_storeu_si128(d++, _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128(d++, _mm_unpackhi_epi32(l, r));
+    }
+    return i;
+}
+
+static int interleave_32_6ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    uint8_t *d = dst;
+    __m128i r[4], lo, hi;
+    int i;
+
+    for (i = 0; i + 4 <= nb_samples; i += 4)
+    {
+        transpose_4x4_32(load(src[0], i, 4), load(src[1], i, 4), load(src[2], i, 4), load(src[3], i, 4), r);
+        // 第4、5声道两两配对，每个样本8字节
+        lo = _mm_unpacklo_epi32(load(src[4], i, 4), load(src[5], i, 4));
+        hi = _mm_unpackhi_epi32(load(src[4], i, 4), load(src[5], i, 4));
+
+        _mm_storeu_si128((__m128i *)d, r[0]);
+        _mm_storel_epi64((__m128i *)(d + 16), lo);
+        _mm_storeu_si128((__m128i *)(d + 24), r[1]);
+        _mm_storel_epi64((__m128i *)(d + 40), _mm_srli_si128(lo, 8));
+        _mm_storeu_si128((__m128i *)(d + 48), r[2]);
+        _mm_storel_epi64((__m128i *)(d + 64), hi);
+        _mm_storeu_si128((__m128i *)(d + 72), r[3]);
+        _mm_storel_epi64((__m128i *)(d + 88), _mm_srli_si128(hi, 8));
+        d += 96;
+    }
+    return i;
+}
+
+static int interleave_32_8ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    __m128i *d = (__m128i *)dst;
+    __m128i a[4], b[4];
+    int i, k;
+
+    for (i = 0; i + 4 <= nb_samples; i += 4)
+    {
+        transpose_4x4_32(load(src[0], i, 4), load(src[1], i, 4), load(src[2], i, 4), load(src[3], i, 4), a);
+        transpose_4x4_32(load(src[4], i, 4), load(src[5], i, 4), load(src[6], i, 4), load(src[7], i, 4), b);
+        for (k = 0; k < 4; k++)
+        {
+            _mm_storeu_si128(d++, a[k]);
+            _mm_storeu_si128(d++, b[k]);
+        }
+    }
+    return i;
+}
+
+static int interleave_16_2ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    __m128i *d = (__m128i *)dst;
+    int i;
+
+    for (i = 0; i + 8 <= nb_samples; i += 8)
+    {
+        __m128i l = load(src[0], i, 2), r = load(src[1], i, 2);
+        _mm_storeu_si128(d++, _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(d++, _mm_unpackhi_epi16(l, r));
+    }
+    return i;
+}
+
+// 8个声道 x 8个16位样本的转置：r[k]是第k个样本的8个声道
+static inline void transpose_8x8_16(const __m128i c[8], __m128i r[8])
+{
+    __m128i a0 = _mm_unpacklo_epi16(c[0], c[1]), a1 = _mm_unpacklo_epi16(c[2], c[3]);
+    __m128i a2 = _mm_unpacklo_epi16(c[4], c[5]), a3 = _mm_unpacklo_epi16(c[6], c[7]);
+    __m128i a4 = _mm_unpackhi_epi16(c[0], c[1]), a5 = _mm_unpackhi_epi16(c[2], c[3]);
+    __m128i a6 = _mm_unpackhi_epi16(c[4], c[5]), a7 = _mm_unpackhi_epi16(c[6], c[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a1), b1 = _mm_unpacklo_epi32(a2, a3);
+    __m128i b2 = _mm_unpackhi_epi32(a0, a1), b3 = _mm_unpackhi_epi32(a2, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a5), b5 = _mm_unpacklo_epi32(a6, a7);
+    __m128i b6 = _mm_unpackhi_epi32(a4, a5), b7 = _mm_unpackhi_epi32(a6, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b1);
+    r[1] = _mm_unpackhi_epi64(b0, b1);
+    r[2] = _mm_unpacklo_epi64(b2, b3);
+    r[3] = _mm_unpackhi_epi64(b2, b3);
+    r[4] = _mm_unpacklo_epi64(b4, b5);
+    r[5] = _mm_unpackhi_epi64(b4, b5);
+    r[6] = _mm_unpacklo_epi64(b6, b7);
+    r[7] = _mm_unpackhi_epi64(b6, b7);
+}
+
+static int interleave_16_6ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    __m128i c[8], r[8];
+    int i, k, ch;
+    int32_t tail;
+
+    // 补两个空声道凑成8x8，每个样本只写前12字节
+    c[6] = c[7] = _mm_setzero_si128();
+    for (i = 0; i + 8 <= nb_samples; i += 8)
+    {
+        for (ch = 0; ch < 6; ch++)
+            c[ch] = load(src[ch], i, 2);
+        transpose_8x8_16(c, r);
+        for (k = 0; k < 8; k++)
+        {
+            _mm_storel_epi64((__m128i *)dst, r[k]);
+            tail = _mm_cvtsi128_si32(_mm_srli_si128(r[k], 8));
+            memcpy(dst + 8, &tail, 4);
+            dst += 12;
+        }
+    }
+    return i;
+}
+
+static int interleave_16_8ch_sse2(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    __m128i *d = (__m128i *)dst;
+    __m128i c[8], r[8];
+    int i, k, ch;
+
+    for (i = 0; i + 8 <= nb_samples; i += 8)
+    {
+        for (ch = 0; ch < 8; ch++)
+            c[ch] = load(src[ch], i, 2);
+        transpose_8x8_16(c, r);
+        for (k = 0; k < 8; k++)
+            _mm_storeu_si128(d++, r[k]);
+    }
+    return i;
+}
+
+#endif
+
+#if HAVE_NEON
+
+// 双声道直接用vst2的交织存储
+static int interleave_32_2ch_neon(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    uint32x4x2_t v;
+    int i;
+
+    for (i = 0; i + 4 <= nb_samples; i += 4)
+    {
+        v.val[0] = vld1q_u32((const uint32_t *)src[0] + i);
+        v.val[1] = vld1q_u32((const uint32_t *)src[1] + i);
+        vst2q_u32((uint32_t *)dst + 2 * i, v);
+    }
+    return i;
+}
+
+static int interleave_16_2ch_neon(uint8_t *dst, const uint8_t *const *src, int nb_samples)
+{
+    uint16x8x2_t v;
+    int i;
+
+    for (i = 0; i + 8 <= nb_samples; i += 8)
+    {
+        v.val[0] = vld1q_u16((const uint16_t *)src[0] + i);
+        v.val[1] = vld1q_u16((const uint16_t *)src[1] + i);
+        vst2q_u16((uint16_t *)dst + 2 * i, v);
+    }
+    return i;
+}
+
+#endif
+
+static void interleave_16(uint8_t *dst, const uint8_t *const *src, int nb_channels, int nb_samples)
+{
+    uint16_t *d = (uint16_t *)dst;
+    int i = 0;
+
+    switch (nb_channels)
+    {
+    case 2:
+#if HAVE_SSE2
+        i = interleave_16_2ch_sse2(dst, src, nb_samples);
+#elif HAVE_NEON
+        i = interleave_16_2ch_neon(dst, src, nb_samples);
+#endif
+        interleave_uint16_t(d, src, 2, i, nb_samples);
+        break;
+    case 6:
+#if HAVE_SSE2
+        i = interleave_16_6ch_sse2(dst, src, nb_samples);
+#endif
+        interleave_uint16_t(d, src, 6, i, nb_samples);
+        break;
+    case 8:
+#if HAVE_SSE2
+        i = interleave_16_8ch_sse2(dst, src, nb_samples);
+#endif
+        interleave_uint16_t(d, src, 8, i, nb_samples);
+        break;
+    default:
+        interleave_uint16_t(d, src, nb_channels, 0, nb_samples);
+        break;
+    }
+}
+
+static void interleave_32(uint8_t *dst, const uint8_t *const *src, int nb_channels, int nb_samples)
+{
+    uint32_t *d = (uint32_t *)dst;
+    int i = 0;
+
+    switch (nb_channels)
+    {
+    case 2:
+#if HAVE_SSE2
+        i = interleave_32_2ch_sse2(dst, src, nb_samples);
+#elif HAVE_NEON
+        i = interleave_32_2ch_neon(dst, src, nb_samples);
+#endif
+        interleave_uint32_t(d, src, 2, i, nb_samples);
+        break;
+    case 6:
+#if HAVE_SSE2
+        i = interleave_32_6ch_sse2(dst, src, nb_samples);
+#endif
+        interleave_uint32_t(d, src, 6, i, nb_samples);
+        break;
+    case 8:
+#if HAVE_SSE2
+        i = interleave_32_8ch_sse2(dst, src, nb_samples);
+#endif
+        interleave_uint32_t(d, src, 8, i, nb_samples);
+        break;
+    default:
+        interleave_uint32_t(d, src, nb_channels, 0, nb_samples);
+        break;
+    }
+}
+
+void audio_interleave(uint8_t *dst, const uint8_t *const *src, int sample_size, int nb_channels, int nb_samples)
+{
+    // 单声道planar和packed是一回事
+    if (nb_channels == 1)
+    {
+        memcpy(dst, src[0], (size_t)sample_size * nb_samples);
+        return;
+    }
+
+    switch (sample_size)
+    {
+    case 1:
+        interleave_uint8_t(dst, src, nb_channels, 0, nb_samples);
+        break;
+    case 2:
+        interleave_16(dst, src, nb_channels, nb_samples);
+        break;
+    case 4:
+        interleave_32(dst, src, nb_channels, nb_samples);
+        break;
+    case 8:
+        interleave_uint64_t((uint64_t *)dst, src, nb_channels, 0, nb_samples);
+        break;
+    default:
+        audio_interleave_memcpy(dst, src, sample_size, nb_channels, nb_samples);
+        break;
+    }
+}
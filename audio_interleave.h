@@ -0,0 +1,28 @@
+// audio_interleave.h
+// planar音频(FLTP/S16P等，每个声道一个plane)交织成SDL要的packed格式。
+//
+// 原来的写法是每个样本每个声道一次memcpy(sample_size)，7.1声道48kHz每秒要调用几十万次。
+// 这里按样本大小(2/4字节)和常见声道数(1/2/6/8)分别实现：x86上用SSE2一次处理4~8个样本做转置，
+// 其他平台和其他声道数用固定类型的循环，输出和逐个memcpy完全一致。
+
+#ifndef AUDIO_INTERLEAVE_H
+#define AUDIO_INTERLEAVE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// src是nb_channels个plane(AVFrame.extended_data)，dst至少nb_samples * nb_channels * sample_size字节
+void audio_interleave(uint8_t *dst, const uint8_t *const *src, int sample_size, int nb_channels, int nb_samples);
+
+// 原来逐样本memcpy的实现，留作对比和校验
+void audio_interleave_memcpy(uint8_t *dst, const uint8_t *const *src, int sample_size, int nb_channels,
+                             int nb_samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
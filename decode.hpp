@@ -0,0 +1,69 @@
+// decode.hpp
+// tutorial03~07共用的解码函数：送一个packet，把解出来的帧逐个交给onFrame。
+//
+// 回调是模板参数，lambda可以直接内联进解码循环，不再经过std::function的间接调用。
+// 输出帧也不再每帧av_frame_alloc/av_frame_free，而是每个线程复用同一个AVFrame，回调返回后av_frame_unref。
+// 一个解码器只会在一个线程里解码(音频在SDL回调线程，视频在解码线程)，所以按线程复用就等于按解码器复用。
+// 回调如果要保留这一帧，必须自己av_frame_ref/av_frame_clone，不能保存指针。
+
+#ifndef DECODE_HPP
+#define DECODE_HPP
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <stdio.h>
+#include <memory>
+#include <atomic>
+
+struct AVFrameDeleter
+{
+    void operator()(AVFrame *frame) const { av_frame_free(&frame); }
+};
+
+// 解码输出帧的分配次数，不同的解码方式都通过decode_frame_alloc分配，才能放在一起比较
+inline std::atomic<int64_t> decode_frame_allocs{0};
+
+inline AVFrame *decode_frame_alloc()
+{
+    decode_frame_allocs++;
+    return av_frame_alloc();
+}
+
+// 当前线程复用的输出帧，线程退出时释放
+inline AVFrame *decode_thread_frame()
+{
+    thread_local std::unique_ptr<AVFrame, AVFrameDeleter> frame(decode_frame_alloc());
+    return frame.get();
+}
+
+template <typename OnFrame>
+static int decode(AVCodecContext *dec_ctx, const AVPacket *pkt, OnFrame &&onFrame)
+{
+    auto frame = decode_thread_frame();
+    int ret;
+
+    /* send the packet with the compressed data to the decoder */
+    ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error submitting the packet to the decoder\n");
+        return ret;
+    }
+
+    /* read all the output frames (in general there may be any number of them */
+    while (ret >= 0)
+    {
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret < 0)
+        {
+            break;
+        }
+        onFrame(frame);
+        av_frame_unref(frame);
+    }
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
+#endif
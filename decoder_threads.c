@@ -0,0 +1,199 @@
+// decoder_threads.c
+// 解码器多线程配置和自动选择，说明见decoder_threads.h
+
+#include "decoder_threads.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/cpu.h>
+#include <libavutil/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 最多缓存这么多个packet用来比较，防止seconds给得太大时内存失控
+#define TUNE_MAX_PACKETS 2000
+
+int decoder_threads_parse_type(DecoderThreads *t, const char *type)
+{
+    t->tune = 0;
+    if (!strcmp(type, "frame"))
+        t->type = FF_THREAD_FRAME;
+    else if (!strcmp(type, "slice"))
+        t->type = FF_THREAD_SLICE;
+    else if (!strcmp(type, "both"))
+        t->type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    else if (!strcmp(type, "tune"))
+        t->tune = 1;
+    else
+        return -1;
+    return 0;
+}
+
+void decoder_threads_apply(AVCodecContext *ctx, const DecoderThreads *t)
+{
+    int type = t->type;
+
+    if (ctx->codec)
+    {
+        if (!(ctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+            type &= ~FF_THREAD_FRAME;
+        if (!(ctx->codec->capabilities & AV_CODEC_CAP_SLICE_THREADS))
+            type &= ~FF_THREAD_SLICE;
+    }
+    if (t->type && type)
+        ctx->thread_type = type;
+    if (t->count_set || t->count > 0 || t->type)
+        ctx->thread_count = t->count;
+}
+
+const char *decoder_threads_name(const DecoderThreads *t, char *buf, int size)
+{
+    const char *type = "default";
+
+    if (t->type == (FF_THREAD_FRAME | FF_THREAD_SLICE))
+        type = "frame+slice";
+    else if (t->type == FF_THREAD_FRAME)
+        type = "frame";
+    else if (t->type == FF_THREAD_SLICE)
+        type = "slice";
+    if (t->count > 0)
+        snprintf(buf, size, "%s x%d", type, t->count);
+    else
+        snprintf(buf, size, "%s x auto", type);
+    return buf;
+}
+
+// 用一种配置把缓存的packet全部解码一遍，返回耗时(微秒)
+static int64_t tune_run(const AVCodecParameters *par, const AVCodec *codec, const DecoderThreads *t,
+                        AVPacket **packets, int nb_packets, int *nb_frames)
+{
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    AVFrame *frame = av_frame_alloc();
+    int64_t t0, elapsed = -1;
+    int i, ret;
+
+    *nb_frames = 0;
+    if (!ctx || !frame || avcodec_parameters_to_context(ctx, par) < 0)
+        goto end;
+    decoder_threads_apply(ctx, t);
+    if (avcodec_open2(ctx, codec, NULL) < 0)
+        goto end;
+
+    t0 = av_gettime_relative();
+    for (i = 0; i <= nb_packets; i++)
+    {
+        // 最后送一个NULL把帧级多线程里压着的帧全部取出来，否则多线程会占便宜
+        ret = avcodec_send_packet(ctx, i < nb_packets ? packets[i] : NULL);
+        if (ret < 0)
+            break;
+        while ((ret = avcodec_receive_frame(ctx, frame)) >= 0)
+        {
+            (*nb_frames)++;
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            break;
+    }
+    elapsed = av_gettime_relative() - t0;
+
+end:
+    av_frame_free(&frame);
+    avcodec_free_context(&ctx);
+    return elapsed;
+}
+
+int decoder_threads_tune(const char *filename, int stream_index, double seconds, DecoderThreads *t)
+{
+    AVFormatContext *fmt = NULL;
+    AVPacket *packets[TUNE_MAX_PACKETS];
+    int nb_packets = 0, nb_cpus = av_cpu_count(), best = -1, i;
+    int64_t best_time = INT64_MAX, limit;
+    const AVCodec *codec;
+    AVStream *st;
+    char name[64];
+    DecoderThreads candidates[] = {
+        {FF_THREAD_SLICE, 1, 0}, // 单线程作为基准
+        {FF_THREAD_FRAME, nb_cpus, 0},
+        {FF_THREAD_SLICE, nb_cpus, 0},
+        {FF_THREAD_FRAME | FF_THREAD_SLICE, nb_cpus, 0},
+        {FF_THREAD_FRAME, nb_cpus / 2, 0},
+    };
+    int nb_candidates = sizeof(candidates) / sizeof(candidates[0]);
+
+    t->tune = 0;
+    if (avformat_open_input(&fmt, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(fmt, NULL) < 0 || stream_index < 0 || stream_index >= (int)fmt->nb_streams)
+        goto fail;
+    st = fmt->streams[stream_index];
+    codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if (!codec)
+        goto fail;
+
+    // 先把开头几秒的packet读进内存，比较时只算解码的时间
+    limit = av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+    while (nb_packets < TUNE_MAX_PACKETS)
+    {
+        AVPacket *pkt = av_packet_alloc();
+        if (av_read_frame(fmt, pkt) < 0)
+        {
+            av_packet_free(&pkt);
+            break;
+        }
+        if (pkt->stream_index != stream_index)
+        {
+            av_packet_free(&pkt);
+            continue;
+        }
+        packets[nb_packets++] = pkt;
+        if (pkt->dts != AV_NOPTS_VALUE && packets[0]->dts != AV_NOPTS_VALUE && pkt->dts - packets[0]->dts >= limit)
+            break;
+    }
+    if (nb_packets == 0)
+        goto fail;
+
+    for (i = 0; i < nb_candidates; i++)
+    {
+        DecoderThreads *c = &candidates[i];
+        int64_t elapsed;
+        int nb_frames;
+
+        if (c->count < 1 || (i > 0 && c->count == 1))
+            continue;
+        if ((c->type & FF_THREAD_FRAME) && !(codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) && c->count > 1)
+            continue;
+        if ((c->type & FF_THREAD_SLICE) && !(codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) && c->count > 1)
+            continue;
+
+        elapsed = tune_run(st->codecpar, codec, c, packets, nb_packets, &nb_frames);
+        if (elapsed < 0)
+            continue;
+        printf("decoder threads %-16s %7.2f ms for %d frames (%.3f ms/frame)\n",
+               decoder_threads_name(c, name, sizeof(name)), elapsed / 1000.0, nb_frames,
+               nb_frames > 0 ? elapsed / 1000.0 / nb_frames : 0.0);
+        if (elapsed < best_time)
+        {
+            best_time = elapsed;
+            best = i;
+        }
+    }
+    if (best < 0)
+        goto fail;
+
+    *t = candidates[best];
+    printf("decoder threads: picked %s for %s (%d packets tested)\n",
+           decoder_threads_name(t, name, sizeof(name)), codec->name, nb_packets);
+
+    for (i = 0; i < nb_packets; i++)
+        av_packet_free(&packets[i]);
+    avformat_close_input(&fmt);
+    return 0;
+
+fail:
+    for (i = 0; i < nb_packets; i++)
+        av_packet_free(&packets[i]);
+    avformat_close_input(&fmt);
+    return -1;
+}
@@ -0,0 +1,38 @@
+// decoder_threads.h
+// 解码器的多线程配置。libavcodec默认的thread_count/thread_type不一定适合当前的编码格式和机器：
+// 帧级多线程吞吐高但每个线程多一帧延迟，slice多线程延迟低但只有编码时切了多个slice才有用。
+//
+// decoder_threads_tune在文件开头解码几秒，依次试几种配置，选出最快的一种。
+// 用的是自己打开的AVFormatContext，不影响调用者的读取位置。
+
+#ifndef DECODER_THREADS_H
+#define DECODER_THREADS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AVCodecContext;
+
+typedef struct DecoderThreads
+{
+    int type;  // FF_THREAD_FRAME/FF_THREAD_SLICE的组合，0表示用libavcodec的默认值
+    int count; // 0表示按CPU核数自动
+    int count_set; // 指定过-j，count为0时也要设置，不然libavcodec默认只用1个线程
+    int tune;  // 打开解码器前先跑decoder_threads_tune
+} DecoderThreads;
+
+// 解析"frame"、"slice"、"both"、"tune"，不认识的返回-1
+int decoder_threads_parse_type(DecoderThreads *t, const char *type);
+// 在avcodec_open2之前调用，解码器不支持的线程方式会被去掉
+void decoder_threads_apply(struct AVCodecContext *ctx, const DecoderThreads *t);
+// 配置的可读名字，比如"frame x8"
+const char *decoder_threads_name(const DecoderThreads *t, char *buf, int size);
+// 用文件开头seconds秒的数据比较几种配置，结果写回t(tune会被清零)
+int decoder_threads_tune(const char *filename, int stream_index, double seconds, DecoderThreads *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
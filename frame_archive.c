@@ -0,0 +1,293 @@
+// frame_archive.c
+// 单文件帧归档，说明见frame_archive.h
+
+#include "frame_archive.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FRAME_ARCHIVE_ALIGN 64
+#define FRAME_ARCHIVE_DEFAULT_CAPACITY (256ULL << 20)
+
+struct FrameArchiveWriter
+{
+    int fd;
+    uint8_t *map;
+    uint64_t capacity;
+    uint64_t used;
+    FrameArchiveEntry *index;
+    uint64_t nb_entries;
+    uint64_t nb_alloc;
+    pthread_mutex_t mutex;
+};
+
+struct FrameArchiveReader
+{
+    int fd;
+    uint8_t *map;
+    uint64_t size;
+    const FrameArchiveEntry *index;
+    uint64_t nb_entries;
+};
+
+static uint64_t align_up(uint64_t v)
+{
+    return (v + FRAME_ARCHIVE_ALIGN - 1) & ~(uint64_t)(FRAME_ARCHIVE_ALIGN - 1);
+}
+
+// 扩展文件并重新映射。预分配真实的磁盘块，避免写映射区时才在page fault里分配。
+// 先映射新的大小再解除旧的映射，任何一步失败时旧的映射和capacity都保持不变，已经写入的帧还在
+static int writer_reserve(FrameArchiveWriter *w, uint64_t capacity)
+{
+    uint8_t *map;
+
+    if (ftruncate(w->fd, capacity) < 0)
+        return -1;
+#ifdef __linux__
+    if (posix_fallocate(w->fd, 0, capacity) != 0)
+        return -1;
+#endif
+    map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    if (w->map)
+        munmap(w->map, w->capacity);
+    w->map = map;
+    w->capacity = capacity;
+    return 0;
+}
+
+int frame_archive_create(FrameArchiveWriter **pw, const char *filename, uint64_t capacity)
+{
+    FrameArchiveWriter *w = calloc(1, sizeof(FrameArchiveWriter));
+
+    if (!w)
+        return -1;
+    if (capacity < sizeof(FrameArchiveHeader))
+        capacity = FRAME_ARCHIVE_DEFAULT_CAPACITY;
+
+    w->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0)
+    {
+        free(w);
+        return -1;
+    }
+    if (writer_reserve(w, capacity) < 0)
+    {
+        close(w->fd);
+        free(w);
+        return -1;
+    }
+    w->used = align_up(sizeof(FrameArchiveHeader));
+    pthread_mutex_init(&w->mutex, NULL);
+    *pw = w;
+    return 0;
+}
+
+int frame_archive_append(FrameArchiveWriter *w, int64_t number, int64_t pts, int width, int height, int format,
+                         const uint8_t *data, int linesize, int row_bytes)
+{
+    uint64_t size = (uint64_t)row_bytes * height;
+    FrameArchiveEntry *entry;
+    uint8_t *dst;
+    int y, ret = -1;
+
+    pthread_mutex_lock(&w->mutex);
+
+    if (!w->map)
+        goto end;
+    if (w->used + size > w->capacity)
+    {
+        uint64_t capacity = w->capacity;
+        while (w->used + size > capacity)
+            capacity *= 2;
+        if (writer_reserve(w, capacity) < 0)
+            goto end;
+    }
+    if (w->nb_entries == w->nb_alloc)
+    {
+        uint64_t nb_alloc = w->nb_alloc ? w->nb_alloc * 2 : 1024;
+        FrameArchiveEntry *index = realloc(w->index, nb_alloc * sizeof(FrameArchiveEntry));
+        if (!index)
+            goto end;
+        w->index = index;
+        w->nb_alloc = nb_alloc;
+    }
+
+    dst = w->map + w->used;
+    if (linesize == row_bytes)
+    {
+        memcpy(dst, data, size);
+    }
+    else
+    {
+        for (y = 0; y < height; y++)
+            memcpy(dst + (uint64_t)y * row_bytes, data + (ptrdiff_t)y * linesize, row_bytes);
+    }
+
+    entry = &w->index[w->nb_entries++];
+    entry->number = number;
+    entry->pts = pts;
+    entry->offset = w->used;
+    entry->size = size;
+    entry->width = width;
+    entry->height = height;
+    entry->format = format;
+    entry->linesize = row_bytes;
+    w->used = align_up(w->used + size);
+    ret = 0;
+
+end:
+    pthread_mutex_unlock(&w->mutex);
+    return ret;
+}
+
+static int compare_number(const void *a, const void *b)
+{
+    const FrameArchiveEntry *x = a, *y = b;
+    return x->number < y->number ? -1 : x->number > y->number;
+}
+
+static int compare_pts(const void *a, const void *b)
+{
+    const FrameArchiveEntry *x = a, *y = b;
+    return x->pts < y->pts ? -1 : x->pts > y->pts;
+}
+
+void frame_archive_renumber_by_pts(FrameArchiveWriter *w)
+{
+    uint64_t i;
+
+    pthread_mutex_lock(&w->mutex);
+    qsort(w->index, w->nb_entries, sizeof(FrameArchiveEntry), compare_pts);
+    for (i = 0; i < w->nb_entries; i++)
+        w->index[i].number = i + 1;
+    pthread_mutex_unlock(&w->mutex);
+}
+
+int frame_archive_close(FrameArchiveWriter **pw)
+{
+    FrameArchiveWriter *w = *pw;
+    FrameArchiveHeader header;
+    uint64_t index_size;
+    int ret = 0;
+
+    if (!w)
+        return 0;
+
+    // 多个worker并行追加时索引顺序是乱的，按帧号排好，读取端就可以二分查找
+    qsort(w->index, w->nb_entries, sizeof(FrameArchiveEntry), compare_number);
+
+    index_size = w->nb_entries * sizeof(FrameArchiveEntry);
+    if (w->map && munmap(w->map, w->capacity) < 0)
+        ret = -1;
+    if (pwrite(w->fd, w->index, index_size, w->used) != (ssize_t)index_size)
+        ret = -1;
+    // 去掉预分配但没用上的空间
+    if (ftruncate(w->fd, w->used + index_size) < 0)
+        ret = -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRAME_ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = FRAME_ARCHIVE_VERSION;
+    header.entry_size = sizeof(FrameArchiveEntry);
+    header.index_offset = w->used;
+    header.nb_entries = w->nb_entries;
+    if (pwrite(w->fd, &header, sizeof(header), 0) != sizeof(header))
+        ret = -1;
+    if (close(w->fd) < 0)
+        ret = -1;
+
+    pthread_mutex_destroy(&w->mutex);
+    free(w->index);
+    free(w);
+    *pw = NULL;
+    return ret;
+}
+
+int frame_archive_open(FrameArchiveReader **pr, const char *filename)
+{
+    FrameArchiveReader *r = calloc(1, sizeof(FrameArchiveReader));
+    const FrameArchiveHeader *header;
+    struct stat st;
+
+    if (!r)
+        return -1;
+    r->fd = open(filename, O_RDONLY);
+    if (r->fd < 0 || fstat(r->fd, &st) < 0 || (uint64_t)st.st_size < sizeof(FrameArchiveHeader))
+        goto fail;
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->map == MAP_FAILED)
+    {
+        r->map = NULL;
+        goto fail;
+    }
+
+    header = (const FrameArchiveHeader *)r->map;
+    if (memcmp(header->magic, FRAME_ARCHIVE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != FRAME_ARCHIVE_VERSION || header->entry_size != sizeof(FrameArchiveEntry) ||
+        header->index_offset > r->size ||
+        header->nb_entries > (r->size - header->index_offset) / sizeof(FrameArchiveEntry))
+        goto fail;
+
+    r->index = (const FrameArchiveEntry *)(r->map + header->index_offset);
+    r->nb_entries = header->nb_entries;
+    *pr = r;
+    return 0;
+
+fail:
+    frame_archive_free(&r);
+    return -1;
+}
+
+uint64_t frame_archive_count(const FrameArchiveReader *r)
+{
+    return r->nb_entries;
+}
+
+const FrameArchiveEntry *frame_archive_entry(const FrameArchiveReader *r, uint64_t i)
+{
+    return i < r->nb_entries ? &r->index[i] : NULL;
+}
+
+const FrameArchiveEntry *frame_archive_find(const FrameArchiveReader *r, int64_t number)
+{
+    uint64_t lo = 0, hi = r->nb_entries;
+
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (r->index[mid].number < number)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < r->nb_entries && r->index[lo].number == number ? &r->index[lo] : NULL;
+}
+
+const uint8_t *frame_archive_data(const FrameArchiveReader *r, const FrameArchiveEntry *entry)
+{
+    if (entry->offset > r->size || entry->size > r->size - entry->offset)
+        return NULL;
+    return r->map + entry->offset;
+}
+
+void frame_archive_free(FrameArchiveReader **pr)
+{
+    FrameArchiveReader *r = *pr;
+
+    if (!r)
+        return;
+    if (r->map)
+        munmap(r->map, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    free(r);
+    *pr = NULL;
+}
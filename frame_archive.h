@@ -0,0 +1,72 @@
+// frame_archive.h
+// 把抽出来的帧追加到一个大文件里，代替每帧一个ppm文件。
+//
+// 文件布局(本机字节序)：
+//
+//   [FrameArchiveHeader 64字节][帧数据, 每帧64字节对齐]...[FrameArchiveEntry * nb_entries]
+//
+// 写入端预分配一大块文件空间并mmap，帧数据直接拷进映射区，不够时加倍扩容；
+// 关闭时把索引按帧号排序写在数据后面，再回填header里的index_offset。
+// 读取端mmap整个文件，frame_archive_data返回的指针直接指向映射区，不做任何拷贝。
+
+#ifndef FRAME_ARCHIVE_H
+#define FRAME_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_ARCHIVE_MAGIC "FRAMEARC"
+#define FRAME_ARCHIVE_VERSION 1
+
+typedef struct FrameArchiveHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t index_offset;
+    uint64_t nb_entries;
+    uint8_t reserved[32];
+} FrameArchiveHeader;
+
+typedef struct FrameArchiveEntry
+{
+    int64_t number;   // 帧号，和ppm模式的frame-N一致
+    int64_t pts;      // 流的time_base单位
+    uint64_t offset;  // 帧数据在文件里的偏移
+    uint64_t size;    // linesize * height
+    int32_t width;
+    int32_t height;
+    int32_t format;   // enum AVPixelFormat
+    int32_t linesize; // 每行字节数，行与行之间没有padding
+} FrameArchiveEntry;
+
+typedef struct FrameArchiveWriter FrameArchiveWriter;
+typedef struct FrameArchiveReader FrameArchiveReader;
+
+// capacity是预分配的字节数，0表示用默认值
+int frame_archive_create(FrameArchiveWriter **pw, const char *filename, uint64_t capacity);
+// 线程安全，多个worker可以同时调用。row_bytes是每行的有效字节数，写入后行与行紧密排列
+int frame_archive_append(FrameArchiveWriter *w, int64_t number, int64_t pts, int width, int height, int format,
+                         const uint8_t *data, int linesize, int row_bytes);
+// 按pts排序后把帧号重新编为1..N，用于写入时还不知道全局帧号的场景
+void frame_archive_renumber_by_pts(FrameArchiveWriter *w);
+int frame_archive_close(FrameArchiveWriter **pw);
+
+int frame_archive_open(FrameArchiveReader **pr, const char *filename);
+uint64_t frame_archive_count(const FrameArchiveReader *r);
+const FrameArchiveEntry *frame_archive_entry(const FrameArchiveReader *r, uint64_t i);
+// 按帧号二分查找，找不到返回NULL
+const FrameArchiveEntry *frame_archive_find(const FrameArchiveReader *r, int64_t number);
+// 指向映射区的只读指针，在frame_archive_free之前一直有效
+const uint8_t *frame_archive_data(const FrameArchiveReader *r, const FrameArchiveEntry *entry);
+void frame_archive_free(FrameArchiveReader **pr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
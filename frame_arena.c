@@ -0,0 +1,242 @@
+// frame_arena.c
+// 解码画面的arena分配器，说明见frame_arena.h
+
+#include "frame_arena.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN 64
+#define HUGE_PAGE_SIZE (2 << 20)
+
+struct FrameArena
+{
+    pthread_mutex_t mutex;
+    int refs; // 1(创建者) + 正在使用的块数，减到0时释放
+    int hugepages;
+
+    // 第一次get_buffer2时确定
+    int width, height, format;
+    int layout_failed;
+    int linesize[4];
+    size_t plane_offset[4];
+    int nb_planes;
+    size_t block_size;
+
+    uint8_t *base;
+    size_t mapped;
+    const char *backing;
+
+    int nb_blocks;
+    int *free_list;
+    int nb_free;
+
+    int in_use, high_water;
+    int64_t served, fallbacks;
+};
+
+FrameArena *frame_arena_create(int nb_blocks, int hugepages)
+{
+    FrameArena *a = calloc(1, sizeof(FrameArena));
+
+    if (!a)
+        return NULL;
+    a->nb_blocks = nb_blocks;
+    a->hugepages = hugepages;
+    a->refs = 1;
+    a->backing = "none";
+    pthread_mutex_init(&a->mutex, NULL);
+    return a;
+}
+
+static void arena_destroy(FrameArena *a)
+{
+    if (a->base)
+        munmap(a->base, a->mapped);
+    pthread_mutex_destroy(&a->mutex);
+    free(a->free_list);
+    free(a);
+}
+
+// 只在持锁时调用
+static void arena_unref_locked(FrameArena *a)
+{
+    if (--a->refs == 0)
+    {
+        pthread_mutex_unlock(&a->mutex);
+        arena_destroy(a);
+        return;
+    }
+    pthread_mutex_unlock(&a->mutex);
+}
+
+static uint8_t *arena_map(FrameArena *a, size_t size)
+{
+    uint8_t *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (a->hugepages)
+    {
+        a->mapped = FFALIGN(size, HUGE_PAGE_SIZE);
+        p = mmap(NULL, a->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            a->backing = "hugetlb";
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+        a->mapped = size;
+        p = mmap(NULL, a->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        a->backing = "4k pages";
+#ifdef MADV_HUGEPAGE
+        // 没有预留大页时，退一步让内核尽量用透明大页
+        if (a->hugepages && madvise(p, a->mapped, MADV_HUGEPAGE) == 0)
+            a->backing = "transparent huge pages";
+#endif
+    }
+    // 提前把所有页碰一遍，解码时就不会再有page fault
+    memset(p, 0, a->mapped);
+    return p;
+}
+
+// 按第一帧的格式和尺寸切块，只在持锁时调用
+static int arena_layout(FrameArena *a, AVCodecContext *s, const AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    int w = frame->width, h = frame->height, i;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    ptrdiff_t linesizes[4];
+    size_t sizes[4], offset = 0;
+
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)))
+        return -1;
+
+    // 和默认分配器一样，先按编码格式的要求把宽高补齐
+    avcodec_align_dimensions2(s, &w, &h, linesize_align);
+    if (av_image_fill_linesizes(a->linesize, frame->format, w) < 0)
+        return -1;
+    for (i = 0; i < 4; i++)
+    {
+        a->linesize[i] = FFALIGN(a->linesize[i], ARENA_ALIGN);
+        linesizes[i] = a->linesize[i];
+    }
+    if (av_image_fill_plane_sizes(sizes, frame->format, h, linesizes) < 0)
+        return -1;
+
+    for (i = 0; i < 4 && sizes[i]; i++)
+    {
+        a->plane_offset[i] = offset;
+        // 每个plane后面留出解码器越界读写需要的padding
+        offset = FFALIGN(offset + sizes[i] + AV_INPUT_BUFFER_PADDING_SIZE, ARENA_ALIGN);
+    }
+    a->nb_planes = i;
+    a->block_size = offset;
+
+    a->base = arena_map(a, a->block_size * a->nb_blocks);
+    a->free_list = malloc(a->nb_blocks * sizeof(int));
+    if (!a->base || !a->free_list)
+        return -1;
+    for (i = 0; i < a->nb_blocks; i++)
+        a->free_list[i] = a->nb_blocks - 1 - i;
+    a->nb_free = a->nb_blocks;
+
+    a->width = frame->width;
+    a->height = frame->height;
+    a->format = frame->format;
+    return 0;
+}
+
+static void arena_release(void *opaque, uint8_t *data)
+{
+    FrameArena *a = opaque;
+
+    pthread_mutex_lock(&a->mutex);
+    a->free_list[a->nb_free++] = (int)((data - a->base) / a->block_size);
+    a->in_use--;
+    arena_unref_locked(a);
+}
+
+int frame_arena_get_buffer2(AVCodecContext *s, AVFrame *frame, int flags)
+{
+    FrameArena *a = s->opaque;
+    uint8_t *block;
+    int index, i;
+
+    pthread_mutex_lock(&a->mutex);
+    if (!a->base && !a->layout_failed && arena_layout(a, s, frame) < 0)
+    {
+        fprintf(stderr, "frame arena: can't lay out %s %dx%d, using the default allocator\n",
+                av_get_pix_fmt_name(frame->format), frame->width, frame->height);
+        a->layout_failed = 1;
+    }
+    if (!a->base || frame->format != a->format || frame->width != a->width || frame->height != a->height ||
+        a->nb_free == 0)
+    {
+        a->fallbacks++;
+        pthread_mutex_unlock(&a->mutex);
+        return avcodec_default_get_buffer2(s, frame, flags);
+    }
+
+    index = a->free_list[--a->nb_free];
+    block = a->base + (size_t)index * a->block_size;
+    frame->buf[0] = av_buffer_create(block, a->block_size, arena_release, a, 0);
+    if (!frame->buf[0])
+    {
+        a->nb_free++;
+        pthread_mutex_unlock(&a->mutex);
+        return AVERROR(ENOMEM);
+    }
+    a->refs++;
+    a->served++;
+    if (++a->in_use > a->high_water)
+        a->high_water = a->in_use;
+    pthread_mutex_unlock(&a->mutex);
+
+    for (i = 0; i < a->nb_planes; i++)
+    {
+        frame->data[i] = block + a->plane_offset[i];
+        frame->linesize[i] = a->linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+void frame_arena_print_stats(FrameArena *a)
+{
+    pthread_mutex_lock(&a->mutex);
+    printf("frame arena: %d blocks of %.2f MB (%s), high water %d blocks (%.1f MB), "
+           "%" PRId64 " frames served, %" PRId64 " fallbacks\n",
+           a->nb_blocks, a->block_size / 1048576.0, a->backing, a->high_water,
+           a->high_water * a->block_size / 1048576.0, a->served, a->fallbacks);
+    pthread_mutex_unlock(&a->mutex);
+}
+
+int64_t frame_arena_fallbacks(FrameArena *a)
+{
+    int64_t n;
+
+    pthread_mutex_lock(&a->mutex);
+    n = a->fallbacks;
+    pthread_mutex_unlock(&a->mutex);
+    return n;
+}
+
+void frame_arena_unref(FrameArena **pa)
+{
+    FrameArena *a = *pa;
+
+    if (!a)
+        return;
+    pthread_mutex_lock(&a->mutex);
+    arena_unref_locked(a);
+    *pa = NULL;
+}
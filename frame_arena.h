@@ -0,0 +1,44 @@
+// frame_arena.h
+// 给视频解码器用的get_buffer2：解码出来的画面从一块预先分配好的大内存(arena)里取，不走libavcodec默认的分配器。
+//
+// arena在第一次get_buffer2时按帧的格式和尺寸切成nb_blocks个块，每块放一帧的所有plane，
+// 每个plane和每行都按64字节对齐。创建时整块内存先写一遍，把page fault都提前处理掉；
+// 可以选择用大页(Linux下MAP_HUGETLB，不行就madvise(MADV_HUGEPAGE))，减少4K画面的TLB miss。
+// 帧的AVBufferRef释放时块回到空闲列表；块用完了或者分辨率变了就退回默认分配器，并计数。
+//
+// 用法：
+//
+//   codecCtx->opaque = frame_arena_create(32, 1);
+//   codecCtx->get_buffer2 = frame_arena_get_buffer2;
+//   ...
+//   frame_arena_print_stats(arena);
+//   frame_arena_unref(&arena); // 还有帧没释放时，等最后一帧释放后才真正回收
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AVCodecContext;
+struct AVFrame;
+
+typedef struct FrameArena FrameArena;
+
+FrameArena *frame_arena_create(int nb_blocks, int hugepages);
+// 作为AVCodecContext.get_buffer2，opaque必须是frame_arena_create返回的FrameArena
+int frame_arena_get_buffer2(struct AVCodecContext *s, struct AVFrame *frame, int flags);
+// 块数、每块大小、同时在用的最大块数、回退到默认分配器的次数等
+void frame_arena_print_stats(FrameArena *arena);
+// 到目前为止回退到默认分配器的次数
+int64_t frame_arena_fallbacks(FrameArena *arena);
+void frame_arena_unref(FrameArena **arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+// plane_convert.c
+// 上传纹理前的plane转换，说明见plane_convert.h
+
+#include "plane_convert.h"
+
+#if defined(__SSE2__)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#else
+#define HAVE_SSE2 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#else
+#define HAVE_NEON 0
+#endif
+
+// 从第start个样本开始的标量循环，SIMD处理不完的行尾也用它
+static inline void narrow16_row(uint8_t *dst, const uint8_t *src, int start, int width, int shift)
+{
+    int i, v;
+
+    for (i = start; i < width; i++)
+    {
+        v = (src[2 * i] | src[2 * i + 1] << 8) >> shift;
+        dst[i] = v > 255 ? 255 : v;
+    }
+}
+
+static inline void halve_width_row(uint8_t *dst, const uint8_t *src, int start, int width)
+{
+    int i;
+
+    for (i = start; i < width; i++)
+        dst[i] = src[2 * i];
+}
+
+// 下面的SIMD内核返回这一行处理完的像素数，剩下的交给标量循环
+
+#if HAVE_SSE2
+
+// packus按有符号16位饱和，移位后最大0xffff >> 2，仍然是正数；超过255的(不合法的10位值)饱和成255，和标量一致
+static int narrow16_row_sse2(uint8_t *dst, const uint8_t *src, int width, int shift)
+{
+    __m128i count = _mm_cvtsi32_si128(shift);
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16)
+    {
+        __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + 2 * i)), count);
+        __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + 2 * i + 16)), count);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+static int halve_width_row_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    __m128i mask = _mm_set1_epi16(0x00ff);
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16)
+    {
+        __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + 2 * i)), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + 2 * i + 16)), mask);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+#elif HAVE_NEON
+
+static int narrow16_row_neon(uint8_t *dst, const uint8_t *src, int width, int shift)
+{
+    int16x8_t count = vdupq_n_s16(-shift);
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16)
+    {
+        uint16x8_t a = vshlq_u16(vld1q_u16((const uint16_t *)(src + 2 * i)), count);
+        uint16x8_t b = vshlq_u16(vld1q_u16((const uint16_t *)(src + 2 * i + 16)), count);
+        vst1q_u8(dst + i, vcombine_u8(vqmovn_u16(a), vqmovn_u16(b)));
+    }
+    return i;
+}
+
+static int halve_width_row_neon(uint8_t *dst, const uint8_t *src, int width)
+{
+    int i;
+
+    for (i = 0; i + 16 <= width; i += 16)
+        vst1q_u8(dst + i, vld2q_u8(src + 2 * i).val[0]);
+    return i;
+}
+
+#endif
+
+void plane_narrow16_c(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width, int height,
+                      int shift)
+{
+    int y;
+
+    for (y = 0; y < height; y++)
+        narrow16_row(dst + (intptr_t)y * dst_linesize, src + (intptr_t)y * src_linesize, 0, width, shift);
+}
+
+void plane_halve_width_c(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width,
+                         int height)
+{
+    int y;
+
+    for (y = 0; y < height; y++)
+        halve_width_row(dst + (intptr_t)y * dst_linesize, src + (intptr_t)y * src_linesize, 0, width);
+}
+
+void plane_narrow16(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width, int height,
+                    int shift)
+{
+    int y, done = 0;
+
+    for (y = 0; y < height; y++, dst += dst_linesize, src += src_linesize)
+    {
+#if HAVE_SSE2
+        done = narrow16_row_sse2(dst, src, width, shift);
+#elif HAVE_NEON
+        done = narrow16_row_neon(dst, src, width, shift);
+#endif
+        narrow16_row(dst, src, done, width, shift);
+    }
+}
+
+void plane_halve_width(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width,
+                       int height)
+{
+    int y, done = 0;
+
+    for (y = 0; y < height; y++, dst += dst_linesize, src += src_linesize)
+    {
+#if HAVE_SSE2
+        done = halve_width_row_sse2(dst, src, width);
+#elif HAVE_NEON
+        done = halve_width_row_neon(dst, src, width);
+#endif
+        halve_width_row(dst, src, done, width);
+    }
+}
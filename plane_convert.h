@@ -0,0 +1,35 @@
+// plane_convert.h
+// 上传纹理前的单个plane转换，SDL不直接支持的画面格式用它们转成IYUV/NV12，比整帧sws_scale便宜得多：
+//
+//   plane_narrow16:    16位样本右移后收窄成8位。yuv420p10le(低10位有效)移2位，p010le(高10位有效)移8位
+//   plane_halve_width: 每两个像素取一个，yuv444p的色度转成420时用；隔行取由调用者把src_linesize乘2
+//
+// x86上用SSE2、ARM上用NEON一次处理16个输出像素，其他平台和每行剩下的部分走标量循环，结果和_c版本完全一致。
+
+#ifndef PLANE_CONVERT_H
+#define PLANE_CONVERT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// width是每行的样本数(p010le的UV plane是2倍色度宽度)，src按16位小端读取
+void plane_narrow16(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width, int height,
+                    int shift);
+// width是输出的像素数，src每行至少2 * width字节
+void plane_halve_width(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width,
+                       int height);
+
+// 标量实现，留作对比和校验
+void plane_narrow16_c(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width, int height,
+                      int shift);
+void plane_halve_width_c(uint8_t *dst, int dst_linesize, const uint8_t *src, int src_linesize, int width,
+                         int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
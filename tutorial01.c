@@ -22,87 +22,1568 @@
 //
 // to write the first five frames from "myvideofile.mpg" to disk in PPM
 // format.
+//
+// tutorial01 -t 8 myvideofile.mpg
+//
+// 流水线模式：1个解包线程 + 解码(主线程) + 8个转换/写文件线程
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/cpu.h>
+
+#include "yuv2rgb.h"
+#include "frame_archive.h"
+#include "decoder_threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// compatibility with newer API
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
+#define av_frame_alloc avcodec_alloc_frame
+#define av_frame_free avcodec_free_frame
+#endif
+
+static void pgm_save(unsigned char *buf, int wrap, int xsize, int ysize,
+                     char *filename)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(filename, "wb");
+    fprintf(f, "P5\n%d %d\n%d\n", xsize, ysize, 255);
+    for (i = 0; i < ysize; i++)
+        fwrite(buf + i * wrap, 1, xsize, f);
+    fclose(f);
+}
+
+static void ppm_save(unsigned char *buf, int wrap, int xsize, int ysize,
+                     char *filename)
+{
+    FILE *f;
+    int i;
+
+    f = fopen(filename, "wb");
+    fprintf(f, "P6\n%d %d\n%d\n", xsize, ysize, 255);
+    for (i = 0; i < ysize; i++)
+        fwrite(buf + i * wrap, 1, xsize*3, f);
+    fclose(f);
+}
+
+// 有界队列，满了push阻塞，空了pop阻塞。close之后pop把剩余的取完就返回-1
+typedef struct QueueItem
+{
+    void *ptr;
+    int64_t number;
+} QueueItem;
+
+typedef struct BoundedQueue
+{
+    QueueItem *items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} BoundedQueue;
+
+static int queue_init(BoundedQueue *q, int capacity)
+{
+    q->items = calloc(capacity, sizeof(QueueItem));
+    if (!q->items)
+        return -1;
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return 0;
+}
+
+static void queue_destroy(BoundedQueue *q)
+{
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->mutex);
+    free(q->items);
+    q->items = NULL;
+}
+
+static void queue_push(BoundedQueue *q, void *ptr, int64_t number)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->capacity)
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    q->items[(q->head + q->count) % q->capacity].ptr = ptr;
+    q->items[(q->head + q->count) % q->capacity].number = number;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static int queue_pop(BoundedQueue *q, QueueItem *item)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    if (q->count == 0)
+    {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    *item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+// 不阻塞的版本，队列满/空时直接返回-1
+static int queue_try_push(BoundedQueue *q, void *ptr, int64_t number)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->count < q->capacity)
+    {
+        q->items[(q->head + q->count) % q->capacity].ptr = ptr;
+        q->items[(q->head + q->count) % q->capacity].number = number;
+        q->count++;
+        pthread_cond_signal(&q->not_empty);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+static int queue_try_pop(BoundedQueue *q, QueueItem *item)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->count > 0)
+    {
+        *item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+static void queue_close(BoundedQueue *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// 异步写文件：转换好的RGB帧连同文件名放进有界队列，由单独的写线程用一次writev写出整个ppm，
+// 不再在解码/转换线程里每行一次fwrite。写完的帧放回空闲列表，生产者下次直接拿来复用，不用重新分配缓冲。
+// 生产者因为队列满而阻塞的时间说明磁盘跟不上；写线程空等的时间说明瓶颈在解码
+typedef struct WriteJob
+{
+    AVFrame *frame;
+    char filename[256];
+} WriteJob;
+
+typedef struct AsyncWriter
+{
+    pthread_t thread;
+    BoundedQueue jobs;
+    BoundedQueue free_jobs;
+    pthread_mutex_t stats_mutex;
+    int64_t blocked_us; // 生产者等队列空位的时间
+    int64_t write_us;   // 写线程在open/writev/close里的时间
+    int64_t idle_us;    // 写线程等任务的时间
+    int64_t frames;
+    int64_t bytes;
+    int error;
+} AsyncWriter;
+
+static AsyncWriter *async_writer;
+
+static int writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0)
+            return -1;
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int64_t write_ppm_vectored(const char *filename, const AVFrame *frame)
+{
+    struct iovec iov[64];
+    char header[64];
+    int row_bytes = frame->width * 3;
+    int count, y = 0, fd, ret = 0;
+    int64_t size;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", frame->width, frame->height, 255);
+    size = iov[0].iov_len + (int64_t)row_bytes * frame->height;
+    count = 1;
+    if (frame->linesize[0] == row_bytes)
+    {
+        // 行之间没有padding，整个画面一次写完
+        iov[count].iov_base = frame->data[0];
+        iov[count++].iov_len = (size_t)row_bytes * frame->height;
+        y = frame->height;
+    }
+    while (ret == 0)
+    {
+        for (; y < frame->height && count < 64; y++, count++)
+        {
+            iov[count].iov_base = frame->data[0] + (ptrdiff_t)y * frame->linesize[0];
+            iov[count].iov_len = row_bytes;
+        }
+        ret = writev_all(fd, iov, count);
+        count = 0;
+        if (y == frame->height)
+            break;
+    }
+    if (close(fd) < 0 || ret < 0)
+        return -1;
+    return size;
+}
+
+static void *async_writer_thread(void *arg)
+{
+    AsyncWriter *w = arg;
+    QueueItem item;
+    int64_t t0 = av_gettime_relative(), t1;
+
+    while (queue_pop(&w->jobs, &item) == 0)
+    {
+        WriteJob *job = item.ptr;
+        int64_t size;
+
+        t1 = av_gettime_relative();
+        w->idle_us += t1 - t0;
+        size = write_ppm_vectored(job->filename, job->frame);
+        t0 = av_gettime_relative();
+        w->write_us += t0 - t1;
+
+        if (size < 0)
+        {
+            fprintf(stderr, "Error writing %s\n", job->filename);
+            w->error = 1;
+        }
+        else
+        {
+            w->frames++;
+            w->bytes += size;
+        }
+        if (queue_try_push(&w->free_jobs, job, 0) < 0)
+        {
+            av_frame_free(&job->frame);
+            free(job);
+        }
+    }
+    return NULL;
+}
+
+static AsyncWriter *async_writer_create(int depth)
+{
+    AsyncWriter *w = calloc(1, sizeof(AsyncWriter));
+
+    queue_init(&w->jobs, depth);
+    queue_init(&w->free_jobs, depth);
+    pthread_mutex_init(&w->stats_mutex, NULL);
+    pthread_create(&w->thread, NULL, async_writer_thread, w);
+    return w;
+}
+
+// 把*rgbFrame交给写线程，换回一个写完了的帧(可能为空，调用者负责按需分配缓冲)
+static void async_writer_submit(AsyncWriter *w, AVFrame **rgbFrame, const char *filename)
+{
+    QueueItem item;
+    WriteJob *job;
+    AVFrame *tmp;
+    int64_t t0;
+
+    if (queue_try_pop(&w->free_jobs, &item) == 0)
+    {
+        job = item.ptr;
+    }
+    else
+    {
+        job = calloc(1, sizeof(WriteJob));
+        job->frame = av_frame_alloc();
+    }
+    tmp = job->frame;
+    job->frame = *rgbFrame;
+    *rgbFrame = tmp;
+    snprintf(job->filename, sizeof(job->filename), "%s", filename);
+
+    t0 = av_gettime_relative();
+    queue_push(&w->jobs, job, 0);
+    pthread_mutex_lock(&w->stats_mutex);
+    w->blocked_us += av_gettime_relative() - t0;
+    pthread_mutex_unlock(&w->stats_mutex);
+}
+
+static int async_writer_close(AsyncWriter **pw)
+{
+    AsyncWriter *w = *pw;
+    QueueItem item;
+    int error;
+
+    if (!w)
+        return 0;
+    queue_close(&w->jobs);
+    pthread_join(w->thread, NULL);
+
+    printf("async writer: %" PRId64 " frames, %.1f MB, writing %.3f s, writer idle %.3f s, "
+           "producers blocked %.3f s\n",
+           w->frames, w->bytes / 1048576.0, w->write_us / 1000000.0, w->idle_us / 1000000.0,
+           w->blocked_us / 1000000.0);
+
+    while (queue_try_pop(&w->free_jobs, &item) == 0)
+    {
+        WriteJob *job = item.ptr;
+        av_frame_free(&job->frame);
+        free(job);
+    }
+    error = w->error;
+    pthread_mutex_destroy(&w->stats_mutex);
+    queue_destroy(&w->free_jobs);
+    queue_destroy(&w->jobs);
+    free(w);
+    *pw = NULL;
+    return error ? -1 : 0;
+}
+
+// 保证rgbFrame是和frame同尺寸的RGB24缓冲，尺寸变化或者刚从写线程换回来时重新分配
+static void alloc_rgb_frame(AVFrame *rgbFrame, const AVFrame *frame)
+{
+    if (rgbFrame->width == frame->width && rgbFrame->height == frame->height && rgbFrame->data[0])
+        return;
+    av_frame_unref(rgbFrame);
+    rgbFrame->format = AV_PIX_FMT_RGB24;
+    rgbFrame->width = frame->width;
+    rgbFrame->height = frame->height;
+    if (av_frame_get_buffer(rgbFrame, 0) < 0)
+    {
+        fprintf(stderr, "Could not allocate RGB frame\n");
+        exit(1);
+    }
+}
+
+// 默认每帧写一个ppm文件；指定了--archive时追加到同一个归档文件里(见frame_archive.h)
+static FrameArchiveWriter *archive;
+
+static void save_rgb(AVFrame **pRgbFrame, int64_t number, int64_t pts, const char *filename)
+{
+    const AVFrame *rgbFrame = *pRgbFrame;
+
+    if (archive)
+    {
+        if (frame_archive_append(archive, number, pts, rgbFrame->width, rgbFrame->height, rgbFrame->format,
+                                 rgbFrame->data[0], rgbFrame->linesize[0], rgbFrame->width * 3) < 0)
+        {
+            fprintf(stderr, "Error appending frame %" PRId64 " to archive\n", number);
+            exit(1);
+        }
+        return;
+    }
+    if (async_writer)
+    {
+        async_writer_submit(async_writer, pRgbFrame, filename);
+        return;
+    }
+    ppm_save(rgbFrame->data[0], rgbFrame->linesize[0],
+             rgbFrame->width, rgbFrame->height, (char *)filename);
+}
+
+// yuv420p -> RGB24 用内置的SIMD内核(见yuv2rgb.h)，为NULL时全部走sws_scale
+static Yuv2RgbFunc fast_yuv2rgb;
+
+static int use_fast_yuv2rgb(const AVFrame *src, const AVFrame *dst)
+{
+    return fast_yuv2rgb && src->format == AV_PIX_FMT_YUV420P && dst->format == AV_PIX_FMT_RGB24 &&
+           src->width == dst->width && src->height == dst->height;
+}
+
+// 分片并行的颜色空间转换：把画面按高度切成N条带，常驻的N个线程各自用自己的SwsContext转换一条。
+// 条带高度按色度的垂直采样对齐，每条带当作一张独立的小图来转换，不缩放时结果和整帧一次转换一致。
+typedef struct SliceConverter SliceConverter;
+
+typedef struct SliceWorker
+{
+    pthread_t thread;
+    SliceConverter *conv;
+    int index;
+    struct SwsContext *swsCtx;
+} SliceWorker;
+
+struct SliceConverter
+{
+    int nb_threads;
+    SliceWorker *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    int64_t generation;
+    int pending;
+    int quit;
+    const AVFrame *src;
+    AVFrame *dst;
+};
+
+static void slice_convert_band(SliceWorker *w, const AVFrame *src, AVFrame *dst)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src->format);
+    int n = w->conv->nb_threads;
+    int band = FFALIGN((src->height + n - 1) / n, 1 << desc->log2_chroma_h);
+    int y0 = w->index * band;
+    int h = FFMIN(band, src->height - y0);
+    const uint8_t *srcSlice[4] = {NULL};
+    uint8_t *dstSlice[4] = {NULL};
+    int p;
+
+    if (h <= 0)
+        return;
+
+    for (p = 0; p < 4 && src->data[p]; p++)
+    {
+        int shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+        srcSlice[p] = src->data[p] + (y0 >> shift) * src->linesize[p];
+    }
+    dstSlice[0] = dst->data[0] + y0 * dst->linesize[0];
+
+    if (use_fast_yuv2rgb(src, dst))
+    {
+        fast_yuv2rgb(srcSlice, src->linesize, dstSlice[0], dst->linesize[0], src->width, h);
+        return;
+    }
+    w->swsCtx = sws_getCachedContext(w->swsCtx,
+                                     src->width, h, src->format,
+                                     dst->width, h, dst->format,
+                                     SWS_BILINEAR, NULL, NULL, NULL);
+    sws_scale(w->swsCtx, srcSlice, src->linesize, 0, h, dstSlice, dst->linesize);
+}
+
+static void *slice_thread(void *arg)
+{
+    SliceWorker *w = arg;
+    SliceConverter *conv = w->conv;
+    int64_t seen = 0;
+
+    pthread_mutex_lock(&conv->mutex);
+    for (;;)
+    {
+        while (!conv->quit && conv->generation == seen)
+            pthread_cond_wait(&conv->start_cond, &conv->mutex);
+        if (conv->quit)
+            break;
+        seen = conv->generation;
+        pthread_mutex_unlock(&conv->mutex);
+
+        slice_convert_band(w, conv->src, conv->dst);
+
+        pthread_mutex_lock(&conv->mutex);
+        if (--conv->pending == 0)
+            pthread_cond_signal(&conv->done_cond);
+    }
+    pthread_mutex_unlock(&conv->mutex);
+    return NULL;
+}
+
+static SliceConverter *slice_converter_create(int nb_threads)
+{
+    SliceConverter *conv = calloc(1, sizeof(SliceConverter));
+    int i;
+
+    conv->nb_threads = nb_threads;
+    conv->workers = calloc(nb_threads, sizeof(SliceWorker));
+    pthread_mutex_init(&conv->mutex, NULL);
+    pthread_cond_init(&conv->start_cond, NULL);
+    pthread_cond_init(&conv->done_cond, NULL);
+    for (i = 0; i < nb_threads; i++)
+    {
+        conv->workers[i].conv = conv;
+        conv->workers[i].index = i;
+        pthread_create(&conv->workers[i].thread, NULL, slice_thread, &conv->workers[i]);
+    }
+    return conv;
+}
+
+static void slice_converter_free(SliceConverter **pconv)
+{
+    SliceConverter *conv = *pconv;
+    int i;
+
+    if (!conv)
+        return;
+    pthread_mutex_lock(&conv->mutex);
+    conv->quit = 1;
+    pthread_cond_broadcast(&conv->start_cond);
+    pthread_mutex_unlock(&conv->mutex);
+    for (i = 0; i < conv->nb_threads; i++)
+    {
+        pthread_join(conv->workers[i].thread, NULL);
+        sws_freeContext(conv->workers[i].swsCtx);
+    }
+    pthread_cond_destroy(&conv->done_cond);
+    pthread_cond_destroy(&conv->start_cond);
+    pthread_mutex_destroy(&conv->mutex);
+    free(conv->workers);
+    free(conv);
+    *pconv = NULL;
+}
+
+// 转换src到dst(同尺寸)，所有条带完成后才返回。调色板格式没法按行切，需要调用者自己走整帧转换
+static int slice_convert(SliceConverter *conv, const AVFrame *src, AVFrame *dst)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src->format);
+
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_PAL))
+        return -1;
+
+    pthread_mutex_lock(&conv->mutex);
+    conv->src = src;
+    conv->dst = dst;
+    conv->pending = conv->nb_threads;
+    conv->generation++;
+    pthread_cond_broadcast(&conv->start_cond);
+    while (conv->pending > 0)
+        pthread_cond_wait(&conv->done_cond, &conv->mutex);
+    pthread_mutex_unlock(&conv->mutex);
+    return 0;
+}
+
+static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
+                    AVFrame **pRgbFrame, struct SwsContext *swsCtx, SliceConverter *slicer)
+{
+    AVFrame *rgbFrame;
+    char buf[1024];
+    int ret;
+
+    ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error sending a packet for decoding\n");
+        exit(1);
+    }
+
+    while (ret >= 0)
+    {
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return;
+        else if (ret < 0)
+        {
+            fprintf(stderr, "Error during decoding\n");
+            exit(1);
+        }
+
+        printf("saving frame %3" PRId64 "\n", dec_ctx->frame_number);
+        fflush(stdout);
+
+        /* the picture is allocated by the decoder. no need to
+           free it */
+        // snprintf(buf, sizeof(buf), "%s-%" PRId64 ".pgm", filename, dec_ctx->frame_number);
+        // pgm_save(frame->data[0], frame->linesize[0],
+        //          frame->width, frame->height, buf);
+
+        // 进行颜色空间转换。异步写的时候*pRgbFrame是刚从写线程换回来的帧，可能还没有缓冲
+        rgbFrame = *pRgbFrame;
+        alloc_rgb_frame(rgbFrame, frame);
+        if (slicer && slice_convert(slicer, frame, rgbFrame) == 0)
+            ;
+        else if (use_fast_yuv2rgb(frame, rgbFrame))
+            fast_yuv2rgb((const uint8_t *const *)frame->data, frame->linesize,
+                         rgbFrame->data[0], rgbFrame->linesize[0], frame->width, frame->height);
+        else
+            sws_scale(swsCtx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+                      rgbFrame->data, rgbFrame->linesize);
+        snprintf(buf, sizeof(buf), "%s-%" PRId64 ".ppm", "frame", dec_ctx->frame_number);
+        save_rgb(pRgbFrame, dec_ctx->frame_number, frame->best_effort_timestamp, buf);
+    }
+}
+
+// 流水线：demux线程 -> pktq -> 解码(主线程) -> frameq -> N个worker(sws_scale + ppm_save)
+// 帧号在解码时分配，文件名和串行模式完全一致，跟worker完成的先后无关
+typedef struct Pipeline
+{
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *dec_ctx;
+    int video_stream;
+    BoundedQueue pktq;
+    BoundedQueue frameq;
+} Pipeline;
+
+typedef struct Worker
+{
+    pthread_t thread;
+    Pipeline *pipeline;
+    int64_t frames_saved;
+} Worker;
+
+static void *demux_thread(void *arg)
+{
+    Pipeline *p = arg;
+    AVPacket *packet = av_packet_alloc();
+
+    while (av_read_frame(p->fmt_ctx, packet) >= 0)
+    {
+        if (packet->stream_index == p->video_stream)
+        {
+            // 包的所有权交给队列，由解码端释放
+            queue_push(&p->pktq, packet, 0);
+            packet = av_packet_alloc();
+        }
+        else
+        {
+            av_packet_unref(packet);
+        }
+    }
+    av_packet_free(&packet);
+    queue_close(&p->pktq);
+    return NULL;
+}
+
+// 转成RGB24。swsCtx和rgbFrame由调用者持有，分辨率变化时重建
+static void convert_rgb(struct SwsContext **swsCtx, AVFrame *rgbFrame, const AVFrame *frame)
+{
+    alloc_rgb_frame(rgbFrame, frame);
+    if (use_fast_yuv2rgb(frame, rgbFrame))
+    {
+        fast_yuv2rgb((const uint8_t *const *)frame->data, frame->linesize,
+                     rgbFrame->data[0], rgbFrame->linesize[0], frame->width, frame->height);
+    }
+    else
+    {
+        *swsCtx = sws_getCachedContext(*swsCtx,
+                                       frame->width, frame->height, frame->format,
+                                       frame->width, frame->height, AV_PIX_FMT_RGB24,
+                                       SWS_BILINEAR, NULL, NULL, NULL);
+        sws_scale(*swsCtx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+                  rgbFrame->data, rgbFrame->linesize);
+    }
+}
+
+static void *convert_thread(void *arg)
+{
+    Worker *w = arg;
+    // 每个worker有自己的SwsContext和RGB缓冲
+    struct SwsContext *swsCtx = NULL;
+    AVFrame *rgbFrame = av_frame_alloc();
+    QueueItem item;
+    char buf[1024];
+
+    while (queue_pop(&w->pipeline->frameq, &item) == 0)
+    {
+        AVFrame *frame = item.ptr;
+
+        snprintf(buf, sizeof(buf), "%s-%" PRId64 ".ppm", "frame", item.number);
+        convert_rgb(&swsCtx, rgbFrame, frame);
+        save_rgb(&rgbFrame, item.number, frame->best_effort_timestamp, buf);
+
+        printf("saving frame %3" PRId64 "\n", item.number);
+        w->frames_saved++;
+        av_frame_free(&frame);
+    }
+
+    av_frame_free(&rgbFrame);
+    sws_freeContext(swsCtx);
+    return NULL;
+}
+
+static void decode_to_queue(AVCodecContext *dec_ctx, AVPacket *pkt, BoundedQueue *frameq)
+{
+    int ret;
+
+    ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error sending a packet for decoding\n");
+        exit(1);
+    }
+
+    while (ret >= 0)
+    {
+        AVFrame *frame = av_frame_alloc();
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        {
+            av_frame_free(&frame);
+            return;
+        }
+        else if (ret < 0)
+        {
+            fprintf(stderr, "Error during decoding\n");
+            exit(1);
+        }
+        queue_push(frameq, frame, dec_ctx->frame_number);
+    }
+}
+
+static int64_t run_pipeline(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int video_stream, int nb_workers)
+{
+    Pipeline p = {fmt_ctx, dec_ctx, video_stream};
+    Worker *workers;
+    pthread_t demuxer;
+    QueueItem item;
+    int64_t frames = 0;
+    int i;
+
+    // 队列长度给worker数的2倍，保证worker不饿，又能限制内存
+    if (queue_init(&p.pktq, 64) < 0 || queue_init(&p.frameq, nb_workers * 2) < 0)
+        return -1;
+    workers = calloc(nb_workers, sizeof(Worker));
+    for (i = 0; i < nb_workers; i++)
+    {
+        workers[i].pipeline = &p;
+        pthread_create(&workers[i].thread, NULL, convert_thread, &workers[i]);
+    }
+    pthread_create(&demuxer, NULL, demux_thread, &p);
+
+    while (queue_pop(&p.pktq, &item) == 0)
+    {
+        AVPacket *packet = item.ptr;
+        decode_to_queue(dec_ctx, packet, &p.frameq);
+        av_packet_free(&packet);
+    }
+    decode_to_queue(dec_ctx, NULL, &p.frameq);
+    queue_close(&p.frameq);
+
+    pthread_join(demuxer, NULL);
+    for (i = 0; i < nb_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        frames += workers[i].frames_saved;
+    }
+
+    free(workers);
+    queue_destroy(&p.frameq);
+    queue_destroy(&p.pktq);
+    return frames;
+}
+
+// 按时间切成K段，每段一个独立的AVFormatContext+解码器。
+// 第k段负责pts落在[start, end)的帧：seek到start之前的关键帧，丢掉pts < start的帧，遇到pts >= end的帧就结束。
+// 解码器按显示顺序输出，所以相邻两段正好首尾相接，不会重复也不会遗漏。
+typedef struct Segment
+{
+    pthread_t thread;
+    const char *filename;
+    int video_stream;
+    int index;
+    int64_t start, end; // 流的time_base单位，INT64_MIN/INT64_MAX表示不限
+    int64_t nb_frames;
+    int64_t first_pts, last_pts;
+    int error;
+} Segment;
+
+// -j/--thread-type指定的解码线程配置，主解码器和分段模式的每个解码器都用它
+static DecoderThreads decoder_threads;
+
+static int open_video_decoder(const char *filename, int video_stream, AVFormatContext **pfmt, AVCodecContext **pdec)
+{
+    AVCodecParameters *codecPar;
+    const AVCodec *codec;
+
+    if (avformat_open_input(pfmt, filename, NULL, NULL) != 0)
+        return -1;
+    if (avformat_find_stream_info(*pfmt, NULL) < 0)
+        return -1;
+    if (video_stream >= (*pfmt)->nb_streams)
+        return -1;
+    codecPar = (*pfmt)->streams[video_stream]->codecpar;
+    codec = avcodec_find_decoder(codecPar->codec_id);
+    if (codec == NULL)
+        return -1;
+    *pdec = avcodec_alloc_context3(codec);
+    if (avcodec_parameters_to_context(*pdec, codecPar) < 0)
+        return -1;
+    decoder_threads_apply(*pdec, &decoder_threads);
+    if (avcodec_open2(*pdec, codec, NULL) < 0)
+        return -1;
+    return 0;
+}
+
+static void segment_tmp_name(char *buf, size_t size, int segment, int64_t n)
+{
+    snprintf(buf, size, "frame-s%d-%" PRId64 ".ppm", segment, n);
+}
+
+static int segment_decode(Segment *seg, AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int video_stream)
+{
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *rgbFrame = av_frame_alloc();
+    struct SwsContext *swsCtx = NULL;
+    AVRational tb = fmt_ctx->streams[video_stream]->time_base;
+    int64_t one_sec = av_rescale_q(AV_TIME_BASE, AV_TIME_BASE_Q, tb);
+    int64_t seek_back = 0;
+    int first = 1, done = 0, eof = 0;
+    int ret = 0;
+    char buf[1024];
+
+    if (seg->start != INT64_MIN && av_seek_frame(fmt_ctx, video_stream, seg->start, AVSEEK_FLAG_BACKWARD) < 0)
+    {
+        fprintf(stderr, "segment %d: seek error\n", seg->index);
+        ret = -1;
+        goto end;
+    }
+
+    while (!done)
+    {
+        if (!eof)
+        {
+            ret = av_read_frame(fmt_ctx, packet);
+            if (ret < 0)
+            {
+                eof = 1;
+                ret = avcodec_send_packet(dec_ctx, NULL);
+            }
+            else if (packet->stream_index != video_stream)
+            {
+                av_packet_unref(packet);
+                continue;
+            }
+            else
+            {
+                ret = avcodec_send_packet(dec_ctx, packet);
+                av_packet_unref(packet);
+            }
+            if (ret < 0)
+            {
+                fprintf(stderr, "segment %d: error sending a packet for decoding\n", seg->index);
+                goto end;
+            }
+        }
+
+        while (!done && (ret = avcodec_receive_frame(dec_ctx, frame)) >= 0)
+        {
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE)
+            {
+                fprintf(stderr, "segment %d: frame without timestamp, can't split by time\n", seg->index);
+                ret = -1;
+                goto end;
+            }
+            if (first && seg->start != INT64_MIN && pts > seg->start)
+            {
+                // 有些demuxer的seek不精确，落在了起点之后，再往前多退一些重试，否则这一段开头会丢帧
+                seek_back += one_sec;
+                if (seek_back > 60 * one_sec ||
+                    av_seek_frame(fmt_ctx, video_stream, seg->start - seek_back, AVSEEK_FLAG_BACKWARD) < 0)
+                {
+                    fprintf(stderr, "segment %d: couldn't seek before segment start\n", seg->index);
+                    ret = -1;
+                    goto end;
+                }
+                avcodec_flush_buffers(dec_ctx);
+                av_frame_unref(frame);
+                eof = 0;
+                break;
+            }
+            first = 0;
+
+            if (pts >= seg->end)
+            {
+                done = 1;
+            }
+            else if (pts >= seg->start)
+            {
+                // 先用段内序号命名，全部完成后再按顺序改成全局帧号
+                segment_tmp_name(buf, sizeof(buf), seg->index, seg->nb_frames);
+                convert_rgb(&swsCtx, rgbFrame, frame);
+                save_rgb(&rgbFrame, seg->nb_frames, pts, buf);
+                if (seg->nb_frames == 0)
+                    seg->first_pts = pts;
+                seg->last_pts = pts;
+                seg->nb_frames++;
+            }
+            av_frame_unref(frame);
+        }
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret < 0 && ret != AVERROR(EAGAIN))
+        {
+            fprintf(stderr, "segment %d: error during decoding\n", seg->index);
+            goto end;
+        }
+    }
+    ret = 0;
+
+end:
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    av_frame_free(&rgbFrame);
+    sws_freeContext(swsCtx);
+    return ret;
+}
+
+static void *segment_thread(void *arg)
+{
+    Segment *seg = arg;
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *dec_ctx = NULL;
+
+    if (open_video_decoder(seg->filename, seg->video_stream, &fmt_ctx, &dec_ctx) < 0)
+    {
+        fprintf(stderr, "segment %d: couldn't open %s\n", seg->index, seg->filename);
+        seg->error = 1;
+    }
+    else if (segment_decode(seg, fmt_ctx, dec_ctx, seg->video_stream) < 0)
+    {
+        seg->error = 1;
+    }
+
+    avcodec_free_context(&dec_ctx);
+    avformat_close_input(&fmt_ctx);
+    return NULL;
+}
+
+static int64_t run_segments(const char *filename, AVFormatContext *fmt_ctx, int video_stream, int nb_segments)
+{
+    AVStream *st = fmt_ctx->streams[video_stream];
+    int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    int64_t duration = st->duration;
+    Segment *segs;
+    int64_t frames = 0, n;
+    char from[1024], to[1024];
+    int i, error = 0;
 
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libswscale/swscale.h>
-#include <libavutil/avutil.h>
-#include <libavutil/imgutils.h>
+    if (duration == AV_NOPTS_VALUE || duration <= 0)
+    {
+        if (fmt_ctx->duration == AV_NOPTS_VALUE)
+        {
+            fprintf(stderr, "Unknown duration, can't split into segments\n");
+            return -1;
+        }
+        duration = av_rescale_q(fmt_ctx->duration, AV_TIME_BASE_Q, st->time_base);
+    }
 
-#include <stdio.h>
+    segs = calloc(nb_segments, sizeof(Segment));
+    for (i = 0; i < nb_segments; i++)
+    {
+        segs[i].filename = filename;
+        segs[i].video_stream = video_stream;
+        segs[i].index = i;
+        // 首尾两段不设边界，防止时长估算不准时丢掉开头或结尾的帧
+        segs[i].start = i == 0 ? INT64_MIN : start + av_rescale(duration, i, nb_segments);
+        segs[i].end = i == nb_segments - 1 ? INT64_MAX : start + av_rescale(duration, i + 1, nb_segments);
+        pthread_create(&segs[i].thread, NULL, segment_thread, &segs[i]);
+    }
+    for (i = 0; i < nb_segments; i++)
+    {
+        pthread_join(segs[i].thread, NULL);
+        error |= segs[i].error;
+    }
+    // -A时各段的临时文件还在写线程的队列里，全部写完才能改名
+    if (async_writer && async_writer_close(&async_writer) < 0)
+    {
+        fprintf(stderr, "Some frames could not be written\n");
+        error = 1;
+    }
 
-// compatibility with newer API
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
-#define av_frame_alloc avcodec_alloc_frame
-#define av_frame_free avcodec_free_frame
-#endif
+    for (i = 0; i < nb_segments && !error; i++)
+    {
+        if (i > 0 && segs[i].nb_frames > 0 && segs[i - 1].nb_frames > 0 &&
+            segs[i].first_pts <= segs[i - 1].last_pts)
+            fprintf(stderr, "segment %d: pts %" PRId64 " overlaps previous segment (%" PRId64 ")\n",
+                    i, segs[i].first_pts, segs[i - 1].last_pts);
 
-static void pgm_save(unsigned char *buf, int wrap, int xsize, int ysize,
-                     char *filename)
+        // 写归档时不用改名，帧号最后按pts统一重编
+        if (archive)
+            frames += segs[i].nb_frames;
+        for (n = 0; n < segs[i].nb_frames && !archive; n++)
+        {
+            segment_tmp_name(from, sizeof(from), i, n);
+            snprintf(to, sizeof(to), "%s-%" PRId64 ".ppm", "frame", ++frames);
+            if (rename(from, to) != 0)
+            {
+                fprintf(stderr, "Couldn't rename %s to %s\n", from, to);
+                error = 1;
+                break;
+            }
+        }
+        printf("segment %d: %" PRId64 " frames\n", i, segs[i].nb_frames);
+    }
+
+    if (archive && !error)
+        frame_archive_renumber_by_pts(archive);
+
+    free(segs);
+    return error ? -1 : frames;
+}
+
+// 只抽关键帧(every <= 0)或者每隔every秒抽一帧。非关键帧的packet解包后直接丢掉，根本不送进解码器，
+// 解码器也设成AVDISCARD_NONKEY兜底；every模式下每个采样点都seek到它之前的关键帧，中间的packet连读都不读
+static int64_t run_sampled(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int video_stream, double every)
 {
-    FILE *f;
-    int i;
+    AVStream *st = fmt_ctx->streams[video_stream];
+    int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    int64_t end = INT64_MAX, step = 0, target = start, last_pts = INT64_MIN;
+    int64_t frames = 0, decoded = 0, skipped = 0;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *rgbFrame = av_frame_alloc();
+    struct SwsContext *swsCtx = NULL;
+    char buf[1024];
+    int ret = 0, need_seek = 0;
 
-    f = fopen(filename, "wb");
-    fprintf(f, "P5\n%d %d\n%d\n", xsize, ysize, 255);
-    for (i = 0; i < ysize; i++)
-        fwrite(buf + i * wrap, 1, xsize, f);
-    fclose(f);
+    dec_ctx->skip_frame = AVDISCARD_NONKEY;
+    if (every > 0)
+    {
+        step = FFMAX(av_rescale_q((int64_t)(every * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base), 1);
+        if (fmt_ctx->duration != AV_NOPTS_VALUE)
+            end = start + av_rescale_q(fmt_ctx->duration, AV_TIME_BASE_Q, st->time_base);
+        need_seek = 1;
+    }
+
+    for (;;)
+    {
+        if (need_seek)
+        {
+            if (target > end || av_seek_frame(fmt_ctx, video_stream, target, AVSEEK_FLAG_BACKWARD) < 0)
+                break;
+            avcodec_flush_buffers(dec_ctx);
+            need_seek = 0;
+        }
+
+        ret = av_read_frame(fmt_ctx, packet);
+        if (ret < 0)
+        {
+            // 读完了，把解码器里剩下的帧取出来
+            avcodec_send_packet(dec_ctx, NULL);
+        }
+        else if (packet->stream_index != video_stream || !(packet->flags & AV_PKT_FLAG_KEY))
+        {
+            if (packet->stream_index == video_stream)
+                skipped++;
+            av_packet_unref(packet);
+            continue;
+        }
+        else
+        {
+            decoded++;
+            ret = avcodec_send_packet(dec_ctx, packet);
+            av_packet_unref(packet);
+            if (ret < 0)
+            {
+                fprintf(stderr, "Error sending a packet for decoding\n");
+                break;
+            }
+        }
+
+        while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0)
+        {
+            int64_t pts = frame->best_effort_timestamp;
+
+            // GOP比采样间隔长时，seek会落回上一次用过的关键帧，跳过它继续往后读
+            if (pts != AV_NOPTS_VALUE && pts <= last_pts)
+            {
+                av_frame_unref(frame);
+                continue;
+            }
+            if (step > 0)
+            {
+                if (pts != AV_NOPTS_VALUE)
+                    while (target <= pts)
+                        target += step;
+                else
+                    target += step;
+                need_seek = 1;
+            }
+            if (pts != AV_NOPTS_VALUE)
+                last_pts = pts;
+
+            frames++;
+            printf("saving frame %3" PRId64 " (pts %" PRId64 ")\n", frames, pts);
+            snprintf(buf, sizeof(buf), "%s-%" PRId64 ".ppm", "frame", frames);
+            convert_rgb(&swsCtx, rgbFrame, frame);
+            save_rgb(&rgbFrame, frames, pts, buf);
+            av_frame_unref(frame);
+            // 剩下的帧属于这个采样点之前，丢掉，去下一个采样点
+            if (need_seek)
+                break;
+        }
+        if (ret == AVERROR_EOF)
+            break;
+        if (ret < 0 && ret != AVERROR(EAGAIN))
+        {
+            fprintf(stderr, "Error during decoding\n");
+            break;
+        }
+    }
+    printf("decoded %" PRId64 " keyframe packets, skipped %" PRId64 " packets without decoding\n",
+           decoded, skipped);
+
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    av_frame_free(&rgbFrame);
+    sws_freeContext(swsCtx);
+    return frames;
 }
 
-static void ppm_save(unsigned char *buf, int wrap, int xsize, int ysize,
-                     char *filename)
+// 缩略图拼图：在片长上均匀取nb_tiles个采样点，各取一个关键帧，拼成一张columns列的大图。
+// 主线程负责seek和解码，解码出的帧交给N个worker；worker用一次sws_scale同时完成缩小和转RGB24，
+// 写进自己的tile缓冲，再拷到画布上对应的格子。格子互不重叠，不需要加锁。
+// 内存只有一张画布、每个worker一个tile、加上队列里最多2N个在途的帧
+typedef struct ContactSheet
 {
-    FILE *f;
-    int i;
+    AVFrame *canvas;
+    int columns;
+    int tile_w, tile_h;
+    BoundedQueue frameq; // number是格子序号
+} ContactSheet;
 
-    f = fopen(filename, "wb");
-    fprintf(f, "P6\n%d %d\n%d\n", xsize, ysize, 255);
-    for (i = 0; i < ysize; i++)
-        fwrite(buf + i * wrap, 1, xsize*3, f);
-    fclose(f);
+typedef struct TileWorker
+{
+    pthread_t thread;
+    ContactSheet *sheet;
+    int64_t tiles;
+} TileWorker;
+
+static void *tile_thread(void *arg)
+{
+    TileWorker *w = arg;
+    ContactSheet *sheet = w->sheet;
+    AVFrame *canvas = sheet->canvas;
+    struct SwsContext *swsCtx = NULL;
+    AVFrame *tile = av_frame_alloc();
+    QueueItem item;
+
+    tile->format = AV_PIX_FMT_RGB24;
+    tile->width = sheet->tile_w;
+    tile->height = sheet->tile_h;
+    if (av_frame_get_buffer(tile, 0) < 0)
+    {
+        fprintf(stderr, "Could not allocate tile\n");
+        exit(1);
+    }
+
+    while (queue_pop(&sheet->frameq, &item) == 0)
+    {
+        AVFrame *frame = item.ptr;
+        int x = item.number % sheet->columns * sheet->tile_w;
+        int y = item.number / sheet->columns * sheet->tile_h;
+
+        swsCtx = sws_getCachedContext(swsCtx, frame->width, frame->height, frame->format,
+                                      sheet->tile_w, sheet->tile_h, AV_PIX_FMT_RGB24,
+                                      SWS_AREA, NULL, NULL, NULL);
+        sws_scale(swsCtx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+                  tile->data, tile->linesize);
+        av_image_copy_plane(canvas->data[0] + y * canvas->linesize[0] + x * 3, canvas->linesize[0],
+                            tile->data[0], tile->linesize[0], sheet->tile_w * 3, sheet->tile_h);
+        w->tiles++;
+        av_frame_free(&frame);
+    }
+
+    av_frame_free(&tile);
+    sws_freeContext(swsCtx);
+    return NULL;
 }
 
-static void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
-                    AVFrame *rgbFrame, struct SwsContext *swsCtx)
+// seek到target之前的关键帧并解码出来。落到的关键帧不晚于last_pts(GOP比采样间隔长)时继续往后找下一个关键帧
+static int grab_keyframe(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int video_stream,
+                         int64_t target, int64_t last_pts, AVPacket *packet, AVFrame *frame)
 {
-    char buf[1024];
     int ret;
 
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0)
+    if (av_seek_frame(fmt_ctx, video_stream, target, AVSEEK_FLAG_BACKWARD) < 0)
+        return -1;
+    avcodec_flush_buffers(dec_ctx);
+
+    for (;;)
     {
-        fprintf(stderr, "Error sending a packet for decoding\n");
+        ret = av_read_frame(fmt_ctx, packet);
+        if (ret < 0)
+        {
+            avcodec_send_packet(dec_ctx, NULL);
+        }
+        else if (packet->stream_index != video_stream || !(packet->flags & AV_PKT_FLAG_KEY))
+        {
+            av_packet_unref(packet);
+            continue;
+        }
+        else
+        {
+            ret = avcodec_send_packet(dec_ctx, packet);
+            av_packet_unref(packet);
+            if (ret < 0)
+                return ret;
+        }
+
+        while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0)
+        {
+            if (frame->best_effort_timestamp == AV_NOPTS_VALUE || frame->best_effort_timestamp > last_pts)
+                return 0;
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+    }
+}
+
+static int64_t run_contact_sheet(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int video_stream,
+                                 const char *filename, int nb_tiles, int columns, int tile_w, int nb_workers)
+{
+    AVStream *st = fmt_ctx->streams[video_stream];
+    int64_t start = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    int64_t duration = st->duration, last_pts = INT64_MIN, tiles = 0;
+    AVRational sar = dec_ctx->sample_aspect_ratio;
+    ContactSheet sheet = {NULL, columns, tile_w};
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    TileWorker *workers;
+    int rows, i, y;
+
+    if (duration == AV_NOPTS_VALUE || duration <= 0)
+    {
+        if (fmt_ctx->duration == AV_NOPTS_VALUE)
+        {
+            fprintf(stderr, "Unknown duration, can't sample a contact sheet\n");
+            return -1;
+        }
+        duration = av_rescale_q(fmt_ctx->duration, AV_TIME_BASE_Q, st->time_base);
+    }
+
+    // 按显示宽高比算格子高度，取偶数
+    if (sar.num <= 0 || sar.den <= 0)
+        sar = (AVRational){1, 1};
+    sheet.tile_h = av_rescale(tile_w, (int64_t)dec_ctx->height * sar.den, (int64_t)dec_ctx->width * sar.num);
+    sheet.tile_h = FFMAX(sheet.tile_h & ~1, 2);
+    rows = (nb_tiles + columns - 1) / columns;
+
+    sheet.canvas = av_frame_alloc();
+    sheet.canvas->format = AV_PIX_FMT_RGB24;
+    sheet.canvas->width = columns * tile_w;
+    sheet.canvas->height = rows * sheet.tile_h;
+    if (av_frame_get_buffer(sheet.canvas, 0) < 0)
+    {
+        fprintf(stderr, "Could not allocate %dx%d canvas\n", sheet.canvas->width, sheet.canvas->height);
+        return -1;
+    }
+    for (y = 0; y < sheet.canvas->height; y++)
+        memset(sheet.canvas->data[0] + y * sheet.canvas->linesize[0], 0, sheet.canvas->width * 3);
+
+    dec_ctx->skip_frame = AVDISCARD_NONKEY;
+    queue_init(&sheet.frameq, nb_workers * 2);
+    workers = calloc(nb_workers, sizeof(TileWorker));
+    for (i = 0; i < nb_workers; i++)
+    {
+        workers[i].sheet = &sheet;
+        pthread_create(&workers[i].thread, NULL, tile_thread, &workers[i]);
+    }
+
+    for (i = 0; i < nb_tiles; i++)
+    {
+        // 取每一格对应时间段的中点
+        int64_t target = start + av_rescale(duration, 2 * i + 1, 2 * nb_tiles);
+
+        if (grab_keyframe(fmt_ctx, dec_ctx, video_stream, target, last_pts, packet, frame) < 0)
+            break;
+        if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+            last_pts = frame->best_effort_timestamp;
+        printf("tile %2d: pts %" PRId64 "\n", i, frame->best_effort_timestamp);
+        queue_push(&sheet.frameq, av_frame_clone(frame), i);
+        av_frame_unref(frame);
+    }
+    queue_close(&sheet.frameq);
+
+    for (i = 0; i < nb_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        tiles += workers[i].tiles;
+    }
+    ppm_save(sheet.canvas->data[0], sheet.canvas->linesize[0], sheet.canvas->width, sheet.canvas->height,
+             (char *)filename);
+    printf("contact sheet %s: %" PRId64 " tiles, %dx%d\n", filename, tiles, sheet.canvas->width,
+           sheet.canvas->height);
+
+    free(workers);
+    queue_destroy(&sheet.frameq);
+    av_frame_free(&sheet.canvas);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    return tiles;
+}
+
+static AVFrame *bench_alloc_frame(enum AVPixelFormat format, int width, int height)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    AVFrame *frame = av_frame_alloc();
+    int p, y, h;
+
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0)
+    {
+        fprintf(stderr, "Could not allocate %dx%d frame\n", width, height);
         exit(1);
     }
+    // 填一些有变化的数据，避免全黑画面走捷径
+    for (p = 0; p < 4 && frame->data[p]; p++)
+    {
+        // 色度plane的行数按log2_chroma_h缩小，和av_image_fill_plane_sizes一致
+        h = (p == 1 || p == 2) ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+        for (y = 0; y < h; y++)
+            memset(frame->data[p] + y * frame->linesize[p], (y * 7 + p * 61) & 0xff, frame->linesize[p]);
+    }
+    return frame;
+}
 
-    while (ret >= 0)
+static int bench_same_rgb(const AVFrame *a, const AVFrame *b)
+{
+    int y;
+
+    for (y = 0; y < a->height; y++)
+        if (memcmp(a->data[0] + y * a->linesize[0], b->data[0] + y * b->linesize[0], a->width * 3))
+            return 0;
+    return 1;
+}
+
+// 整帧一次sws_scale和分片并行转换的对比，不需要输入文件
+static void bench_slices(int nb_threads)
+{
+    static const int sizes[][2] = {{1920, 1080}, {3840, 2160}};
+    const int iterations = 30;
+    Yuv2RgbFunc saved = fast_yuv2rgb;
+    int i, n;
+
+    // 两边都用sws_scale，只比较分片并行本身的收益
+    fast_yuv2rgb = NULL;
+
+    for (i = 0; i < 2; i++)
     {
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            return;
-        else if (ret < 0)
+        int w = sizes[i][0], h = sizes[i][1];
+        AVFrame *src = bench_alloc_frame(AV_PIX_FMT_YUV420P, w, h);
+        AVFrame *dst1 = bench_alloc_frame(AV_PIX_FMT_RGB24, w, h);
+        AVFrame *dst2 = bench_alloc_frame(AV_PIX_FMT_RGB24, w, h);
+        struct SwsContext *swsCtx = sws_getContext(w, h, AV_PIX_FMT_YUV420P, w, h, AV_PIX_FMT_RGB24,
+                                                   SWS_BILINEAR, NULL, NULL, NULL);
+        SliceConverter *slicer = slice_converter_create(nb_threads);
+        int64_t t0, t1, t2;
+
+        // 预热，让各线程的SwsContext先建好
+        sws_scale(swsCtx, (const uint8_t *const *)src->data, src->linesize, 0, h, dst1->data, dst1->linesize);
+        slice_convert(slicer, src, dst2);
+
+        t0 = av_gettime_relative();
+        for (n = 0; n < iterations; n++)
+            sws_scale(swsCtx, (const uint8_t *const *)src->data, src->linesize, 0, h, dst1->data, dst1->linesize);
+        t1 = av_gettime_relative();
+        for (n = 0; n < iterations; n++)
+            slice_convert(slicer, src, dst2);
+        t2 = av_gettime_relative();
+
+        printf("%dx%d: sws_scale %.3f ms/frame, %d slices %.3f ms/frame (%.2fx), output %s\n",
+               w, h, (t1 - t0) / 1000.0 / iterations, nb_threads, (t2 - t1) / 1000.0 / iterations,
+               (double)(t1 - t0) / FFMAX(t2 - t1, 1), bench_same_rgb(dst1, dst2) ? "identical" : "differs");
+
+        slice_converter_free(&slicer);
+        sws_freeContext(swsCtx);
+        av_frame_free(&dst2);
+        av_frame_free(&dst1);
+        av_frame_free(&src);
+    }
+    fast_yuv2rgb = saved;
+}
+
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void bench_fill_random(AVFrame *frame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    unsigned int seed = 1;
+    int p, y, x, h;
+
+    for (p = 0; p < 4 && frame->data[p]; p++)
+    {
+        h = (p == 1 || p == 2) ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        for (y = 0; y < h; y++)
+            for (x = 0; x < frame->linesize[p]; x++)
+            {
+                seed = seed * 1103515245 + 12345;
+                frame->data[p][y * frame->linesize[p] + x] = seed >> 16;
+            }
+    }
+}
+
+static int bench_max_diff(const AVFrame *a, const AVFrame *b)
+{
+    int x, y, d, max_diff = 0;
+
+    for (y = 0; y < a->height; y++)
+        for (x = 0; x < a->width * 3; x++)
         {
-            fprintf(stderr, "Error during decoding\n");
-            exit(1);
+            d = abs(a->data[0][y * a->linesize[0] + x] - b->data[0][y * b->linesize[0] + x]);
+            if (d > max_diff)
+                max_diff = d;
         }
+    return max_diff;
+}
 
-        printf("saving frame %3" PRId64 "\n", dec_ctx->frame_number);
-        fflush(stdout);
+// 内置yuv420p->RGB24内核(C/SSE4/AVX2)和sws_scale(SWS_BILINEAR)的对比。
+// cycles用的是TSC，是固定频率的参考周期，不是核心实际跑的周期
+static void bench_yuv2rgb(void)
+{
+    const int w = 1920, h = 1080, iterations = 50;
+    const char *names[] = {"c", "sse4", "avx2"};
+    Yuv2RgbFunc fns[3] = {yuv420p_to_rgb24_c, yuv420p_to_rgb24_sse4(), yuv420p_to_rgb24_avx2()};
+    AVFrame *src = bench_alloc_frame(AV_PIX_FMT_YUV420P, w, h);
+    AVFrame *ref = bench_alloc_frame(AV_PIX_FMT_RGB24, w, h);
+    AVFrame *dst = bench_alloc_frame(AV_PIX_FMT_RGB24, w, h);
+    struct SwsContext *swsCtx = sws_getContext(w, h, AV_PIX_FMT_YUV420P, w, h, AV_PIX_FMT_RGB24,
+                                               SWS_BILINEAR, NULL, NULL, NULL);
+    double pixels = (double)w * h * iterations;
+    int64_t t0;
+    uint64_t c0;
+    int i, n;
 
-        /* the picture is allocated by the decoder. no need to
-           free it */
-        // snprintf(buf, sizeof(buf), "%s-%" PRId64 ".pgm", filename, dec_ctx->frame_number);
-        // pgm_save(frame->data[0], frame->linesize[0],
-        //          frame->width, frame->height, buf);
+    bench_fill_random(src);
+    printf("fixed-point vs floating point BT.601 reference: max error %d\n", yuv2rgb_reference_max_error());
 
-        // 进行颜色空间转换
-        sws_scale(swsCtx, frame->data[0], frame->linesize, 0, frame->height,
-                rgbFrame->data, rgbFrame->linesize);
-        snprintf(buf, sizeof(buf), "%s-%" PRId64 ".ppm", "frame", dec_ctx->frame_number);
-        ppm_save(rgbFrame->data[0], rgbFrame->linesize[0],
-                 rgbFrame->width, rgbFrame->height, buf);
+    yuv420p_to_rgb24_c((const uint8_t *const *)src->data, src->linesize, ref->data[0], ref->linesize[0], w, h);
+    for (i = 0; i < 3; i++)
+    {
+        if (!fns[i])
+        {
+            printf("%-9s not supported on this CPU\n", names[i]);
+            continue;
+        }
+        fns[i]((const uint8_t *const *)src->data, src->linesize, dst->data[0], dst->linesize[0], w, h);
+        t0 = av_gettime_relative();
+        c0 = bench_cycles();
+        for (n = 0; n < iterations; n++)
+            fns[i]((const uint8_t *const *)src->data, src->linesize, dst->data[0], dst->linesize[0], w, h);
+        printf("%-9s %.3f cycles/pixel, %.3f ns/pixel, max diff vs c %d\n", names[i],
+               (bench_cycles() - c0) / pixels, (av_gettime_relative() - t0) * 1000.0 / pixels,
+               bench_max_diff(ref, dst));
+    }
+
+    sws_scale(swsCtx, (const uint8_t *const *)src->data, src->linesize, 0, h, dst->data, dst->linesize);
+    t0 = av_gettime_relative();
+    c0 = bench_cycles();
+    for (n = 0; n < iterations; n++)
+        sws_scale(swsCtx, (const uint8_t *const *)src->data, src->linesize, 0, h, dst->data, dst->linesize);
+    printf("%-9s %.3f cycles/pixel, %.3f ns/pixel, max diff vs c %d\n", "sws_scale",
+           (bench_cycles() - c0) / pixels, (av_gettime_relative() - t0) * 1000.0 / pixels,
+           bench_max_diff(ref, dst));
+
+    sws_freeContext(swsCtx);
+    av_frame_free(&dst);
+    av_frame_free(&ref);
+    av_frame_free(&src);
+}
+
+// 归档读取示例：不带帧号时列出索引；带帧号时直接从映射区把这一帧写成ppm，中间没有拷贝
+static int read_archive(const char *filename, const char *number)
+{
+    FrameArchiveReader *reader;
+    const FrameArchiveEntry *entry;
+    char buf[1024];
+    uint64_t i;
+
+    if (frame_archive_open(&reader, filename) < 0)
+    {
+        fprintf(stderr, "Couldn't open archive %s\n", filename);
+        return -1;
+    }
+
+    if (!number)
+    {
+        for (i = 0; i < frame_archive_count(reader); i++)
+        {
+            entry = frame_archive_entry(reader, i);
+            printf("frame %6" PRId64 " pts %10" PRId64 " offset %12" PRIu64 " %dx%d %s\n",
+                   entry->number, entry->pts, entry->offset, entry->width, entry->height,
+                   av_get_pix_fmt_name(entry->format));
+        }
+        frame_archive_free(&reader);
+        return 0;
     }
+
+    entry = frame_archive_find(reader, strtoll(number, NULL, 10));
+    if (!entry || entry->format != AV_PIX_FMT_RGB24 || !frame_archive_data(reader, entry))
+    {
+        fprintf(stderr, "No RGB24 frame %s in %s\n", number, filename);
+        frame_archive_free(&reader);
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%s-%" PRId64 ".ppm", "frame", entry->number);
+    ppm_save((unsigned char *)frame_archive_data(reader, entry), entry->linesize,
+             entry->width, entry->height, buf);
+    frame_archive_free(&reader);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] <movie file>\n"
+                    "  -t, --threads N    pipeline mode with N convert/write workers (0 = serial)\n"
+                    "  -s, --segments K   split the input into K time ranges decoded in parallel\n"
+                    "  -S, --slice-threads N  convert each frame in N horizontal bands in parallel\n"
+                    "      --bench-slices     compare sws_scale with slice conversion at 1080p and 4K, then exit\n"
+                    "      --sws              always convert with sws_scale, disable the built-in yuv420p kernel\n"
+                    "      --bench-yuv        compare the built-in yuv420p kernels with sws_scale, then exit\n"
+                    "  -o, --archive FILE     append all frames to one indexed archive instead of frame-N.ppm\n"
+                    "      --keyframes-only   only decode and save keyframes\n"
+                    "      --every SECONDS    seek to one keyframe every SECONDS and save it\n"
+                    "      --contact-sheet FILE  save sampled keyframes as one thumbnail mosaic (ppm)\n"
+                    "      --tiles N          number of thumbnails on the contact sheet (default 16)\n"
+                    "      --columns N        thumbnails per row (default 4)\n"
+                    "      --tile-width W     thumbnail width in pixels (default 320)\n"
+                    "  -j, --decoder-threads N  decoder thread count (0 = one per CPU)\n"
+                    "      --thread-type TYPE decoder threading: frame, slice, both, or tune to benchmark them first\n"
+                    "  -A, --async-write      write frame-N.ppm on a background thread with one writev per file\n"
+                    "      --read-archive FILE [N]  list the archive index, or write frame N out as frame-N.ppm\n",
+            prog);
 }
 
 int main(int argc, char *argv[])
@@ -120,17 +1601,135 @@ int main(int argc, char *argv[])
     int numBytes;
     struct SwsContext *sws_ctx = NULL;
     int ret;
+    int nb_threads = 0;
+    int nb_segments = 0;
+    int nb_slice_threads = 0;
+    int bench = 0;
+    int use_sws = 0;
+    const char *yuv2rgb_name = "sws_scale";
+    const char *archive_name = NULL;
+    int async_write = 0;
+    int keyframes_only = 0;
+    double every = 0;
+    const char *sheet_name = NULL;
+    int nb_tiles = 16, columns = 4, tile_w = 320;
+    SliceConverter *slicer = NULL;
+    const char *filename;
+    int64_t start_time, frames;
+    double elapsed;
+    char mode[64]; // 实际跑的模式和它的参数，最后和fps一起打印
+    int opt;
+
+    static const struct option long_options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"segments", required_argument, NULL, 's'},
+        {"slice-threads", required_argument, NULL, 'S'},
+        {"bench-slices", no_argument, NULL, 'B'},
+        {"sws", no_argument, NULL, 'W'},
+        {"bench-yuv", no_argument, NULL, 'Y'},
+        {"archive", required_argument, NULL, 'o'},
+        {"read-archive", required_argument, NULL, 'R'},
+        {"async-write", no_argument, NULL, 'A'},
+        {"keyframes-only", no_argument, NULL, 'K'},
+        {"every", required_argument, NULL, 'E'},
+        {"decoder-threads", required_argument, NULL, 'j'},
+        {"thread-type", required_argument, NULL, 'T'},
+        {"contact-sheet", required_argument, NULL, 'C'},
+        {"tiles", required_argument, NULL, 'N'},
+        {"columns", required_argument, NULL, 'L'},
+        {"tile-width", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0},
+    };
+    while ((opt = getopt_long(argc, argv, "t:s:S:o:Aj:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            nb_threads = atoi(optarg);
+            break;
+        case 's':
+            nb_segments = atoi(optarg);
+            break;
+        case 'S':
+            nb_slice_threads = atoi(optarg);
+            break;
+        case 'B':
+            bench = 'B';
+            break;
+        case 'W':
+            use_sws = 1;
+            break;
+        case 'Y':
+            bench = 'Y';
+            break;
+        case 'o':
+            archive_name = optarg;
+            break;
+        case 'A':
+            async_write = 1;
+            break;
+        case 'K':
+            keyframes_only = 1;
+            break;
+        case 'E':
+            every = atof(optarg);
+            break;
+        case 'j':
+            decoder_threads.count = atoi(optarg);
+            decoder_threads.count_set = 1;
+            break;
+        case 'T':
+            if (decoder_threads_parse_type(&decoder_threads, optarg) < 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'C':
+            sheet_name = optarg;
+            break;
+        case 'N':
+            nb_tiles = atoi(optarg);
+            break;
+        case 'L':
+            columns = atoi(optarg);
+            break;
+        case 'w':
+            tile_w = atoi(optarg) & ~1;
+            break;
+        case 'R':
+            return read_archive(optarg, optind < argc ? argv[optind] : NULL);
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!use_sws)
+        fast_yuv2rgb = yuv2rgb_select(&yuv2rgb_name);
+
+    if (bench == 'B')
+    {
+        bench_slices(nb_slice_threads > 0 ? nb_slice_threads : av_cpu_count());
+        return 0;
+    }
+    if (bench == 'Y')
+    {
+        bench_yuv2rgb();
+        return 0;
+    }
 
-    if (argc < 2)
+    if (optind >= argc)
     {
         printf("Please provide a movie file\n");
         return -1;
     }
+    filename = argv[optind];
     // Register all formats and codecs
     // av_register_all();
 
     // Open video file
-    if (avformat_open_input(&pFormatCtx, argv[1], NULL, NULL) != 0)
+    if (avformat_open_input(&pFormatCtx, filename, NULL, NULL) != 0)
         return -1; // Couldn't open file
 
     // Retrieve stream information
@@ -138,7 +1737,8 @@ int main(int argc, char *argv[])
         return -1; // Couldn't find stream information
 
     // Dump information about file onto standard error
-    av_dump_format(pFormatCtx, 0, argv[1], 0);
+    av_dump_format(pFormatCtx, 0, filename, 0);
+    fprintf(stderr, "yuv420p -> RGB24 converter: %s\n", yuv2rgb_name);
 
     // Find the first video stream
     videoStream = -1;
@@ -169,9 +1769,83 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // 解码线程：tune先在开头几秒上比较几种配置
+    if (decoder_threads.tune && decoder_threads_tune(filename, videoStream, 3.0, &decoder_threads) < 0)
+        fprintf(stderr, "Decoder thread tuning failed, using defaults\n");
+    decoder_threads_apply(pCodecCtx, &decoder_threads);
+
     // Open codec
     if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
         return -1; // Could not open codec
+    fprintf(stderr, "decoder threads: %d, type %s\n", pCodecCtx->thread_count,
+            pCodecCtx->active_thread_type == FF_THREAD_FRAME   ? "frame"
+            : pCodecCtx->active_thread_type == FF_THREAD_SLICE ? "slice"
+                                                               : "none");
+
+    if (archive_name)
+    {
+        AVStream *st = pFormatCtx->streams[videoStream];
+        int64_t nb_frames = st->nb_frames;
+        uint64_t capacity = 0;
+
+        // 按帧数估算预分配的大小，最多先分配1GB，不够时归档会自己扩容
+        if (nb_frames <= 0 && st->avg_frame_rate.den && pFormatCtx->duration != AV_NOPTS_VALUE)
+            nb_frames = pFormatCtx->duration * av_q2d(st->avg_frame_rate) / AV_TIME_BASE;
+        if (nb_frames > 0)
+            capacity = FFMIN((uint64_t)nb_frames * (FFALIGN(pCodecCtx->width * 3 * pCodecCtx->height, 64)),
+                             1ULL << 30);
+        if (frame_archive_create(&archive, archive_name, capacity) < 0)
+        {
+            fprintf(stderr, "Couldn't create archive %s\n", archive_name);
+            return -1;
+        }
+    }
+
+    // 归档模式本来就是一次追加，不需要再开写线程
+    if (async_write && !archive)
+        async_writer = async_writer_create(16);
+
+    start_time = av_gettime_relative();
+    if (nb_segments > 0)
+    {
+        frames = run_segments(filename, pFormatCtx, videoStream, nb_segments);
+        if (frames < 0)
+            return -1;
+        snprintf(mode, sizeof(mode), "%d segments", nb_segments);
+        goto done;
+    }
+    if (sheet_name)
+    {
+        if (nb_tiles <= 0 || columns <= 0 || tile_w <= 0)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        frames = run_contact_sheet(pFormatCtx, pCodecCtx, videoStream, sheet_name, nb_tiles, columns, tile_w,
+                                   nb_threads > 0 ? nb_threads : av_cpu_count());
+        if (frames < 0)
+            return -1;
+        snprintf(mode, sizeof(mode), "contact sheet, %d tiles, %d tile workers", nb_tiles,
+                 nb_threads > 0 ? nb_threads : av_cpu_count());
+        goto done;
+    }
+    if (keyframes_only || every > 0)
+    {
+        frames = run_sampled(pFormatCtx, pCodecCtx, videoStream, every);
+        if (every > 0)
+            snprintf(mode, sizeof(mode), "sampled every %g s", every);
+        else
+            snprintf(mode, sizeof(mode), "keyframes only");
+        goto done;
+    }
+    if (nb_threads > 0)
+    {
+        frames = run_pipeline(pFormatCtx, pCodecCtx, videoStream, nb_threads);
+        if (frames < 0)
+            return -1;
+        snprintf(mode, sizeof(mode), "pipeline, %d worker threads", nb_threads);
+        goto done;
+    }
 
     // Allocate video frame
     pFrame = av_frame_alloc();
@@ -179,7 +1853,7 @@ int main(int argc, char *argv[])
     // 创建一个新的AVFrame对象
     pRGBFrame = av_frame_alloc();
     // 设置新的AVFrame参数
-    pRGBFrame->format = AV_PIX_FMT_RGB32;
+    pRGBFrame->format = AV_PIX_FMT_RGB24;
     pRGBFrame->width = pCodecCtx->width;
     pRGBFrame->height = pCodecCtx->height;
     // 分配内存
@@ -200,6 +1874,9 @@ int main(int argc, char *argv[])
                              NULL,
                              NULL);
 
+    if (nb_slice_threads > 1)
+        slicer = slice_converter_create(nb_slice_threads);
+
     packet = av_packet_alloc();
     // Read frames and save first five frames to disk
     i = 0;
@@ -208,13 +1885,18 @@ int main(int argc, char *argv[])
         // Is this a packet from the video stream?
         if (packet->stream_index == videoStream)
         {
-            decode(pCodecCtx, pFrame, packet, pRGBFrame, sws_ctx);
+            decode(pCodecCtx, pFrame, packet, &pRGBFrame, sws_ctx, slicer);
         }
 
         // Free the packet that was allocated by av_read_frame
         av_packet_unref(packet);
     }
-    decode(pCodecCtx, pFrame, NULL, pRGBFrame, sws_ctx);
+    decode(pCodecCtx, pFrame, NULL, &pRGBFrame, sws_ctx, slicer);
+    frames = pCodecCtx->frame_number;
+    if (slicer)
+        snprintf(mode, sizeof(mode), "serial, %d slice threads", nb_slice_threads);
+    else
+        snprintf(mode, sizeof(mode), "serial");
 
     av_packet_free(&packet);
 
@@ -222,6 +1904,17 @@ int main(int argc, char *argv[])
     av_frame_free(&pFrame);
 
     av_frame_free(&pRGBFrame);
+    sws_freeContext(sws_ctx);
+    slice_converter_free(&slicer);
+
+done:
+    if (async_writer && async_writer_close(&async_writer) < 0)
+        fprintf(stderr, "Some frames could not be written\n");
+    if (archive && frame_archive_close(&archive) < 0)
+        fprintf(stderr, "Error writing archive %s\n", archive_name);
+    elapsed = (av_gettime_relative() - start_time) / 1000000.0;
+    printf("%" PRId64 " frames in %.3f s, %.2f fps (%s)\n",
+           frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0, mode);
 
     // Close the codecs
     avcodec_close(pCodecCtx);
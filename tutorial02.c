@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 
+#include "video_texture.h"
+
 // compatibility with newer API
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
 #define av_frame_alloc avcodec_alloc_frame
@@ -16,7 +18,7 @@
 SDL_Renderer *g_renderer;
 
 static void decode(AVCodecContext *dec_ctx, AVPacket *pkt,
-                   SDL_Texture *texture)
+                   VideoTexture *texture)
 {
     char buf[1024];
     int ret;
@@ -43,16 +45,13 @@ static void decode(AVCodecContext *dec_ctx, AVPacket *pkt,
         }
 
         // 将YUV数据填充到SDL纹理中
-        SDL_UpdateYUVTexture(texture, NULL,
-                             frame->data[0], frame->linesize[0],
-                             frame->data[1], frame->linesize[1],
-                             frame->data[2], frame->linesize[2]);
+        video_texture_upload(texture, frame);
 
         // 清空渲染器
         SDL_RenderClear(g_renderer);
 
         // 将纹理复制到渲染器
-        SDL_RenderCopy(g_renderer, texture, NULL, NULL);
+        SDL_RenderCopy(g_renderer, texture->texture, NULL, NULL);
 
         // 刷新屏幕
         SDL_RenderPresent(g_renderer);
@@ -104,13 +103,9 @@ int main(int argc, char *argv[])
     }
     g_renderer = renderer;
 
-    // 创建SDL纹理
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, 640, 480);
-    if (!texture)
-    {
-        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
-        return -1;
-    }
+    // SDL纹理按画面尺寸在第一帧时创建，分辨率变化时重建
+    VideoTexture texture;
+    video_texture_init(&texture, renderer);
 
     // Open video file
     if (avformat_open_input(&pFormatCtx, argv[1], NULL, NULL) != 0)
@@ -185,7 +180,7 @@ int main(int argc, char *argv[])
             // Is this a packet from the video stream?
             if (packet->stream_index == videoStream)
             {
-                decode(pCodecCtx, packet, texture);
+                decode(pCodecCtx, packet, &texture);
             }
 
             // Free the packet that was allocated by av_read_frame
@@ -193,7 +188,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            decode(pCodecCtx, NULL, texture);
+            decode(pCodecCtx, NULL, &texture);
             quit = SDL_TRUE;
         }
     }
@@ -208,7 +203,7 @@ int main(int argc, char *argv[])
     avformat_close_input(&pFormatCtx);
 
     // 销毁SDL纹理、渲染器和窗口
-    SDL_DestroyTexture(texture);
+    video_texture_destroy(&texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
@@ -4,11 +4,18 @@ extern "C" {
 #include <libswscale/swscale.h>
 #include <libavutil/avutil.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/time.h>
 }
 
+#include "audio_interleave.h"
+#include "decode.hpp"
+#include "video_texture.h"
+
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <list>
+#include <vector>
+#include <functional>
 
 // compatibility with newer API
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
@@ -79,33 +86,6 @@ struct PacketQueue
     }
 } g_audioq;
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame)
-{
-    int ret = AVERROR(1);
-
-    /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0)
-    {
-        fprintf(stderr, "Error submitting the packet to the decoder\n");
-        return ret;
-    }
-
-    /* read all the output frames (in general there may be any number of them */
-    while (ret >= 0)
-    {
-        auto frame = av_frame_alloc();
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret < 0)
-        {
-            break;
-        }
-        onFrame(frame);
-        av_frame_free(&frame);
-    }
-    return ret == AVERROR(EAGAIN) ? 0 : ret;
-}
-
 int audio_decode_frame(AVCodecContext *aCodecCtx, uint8_t *audio_buf, int buf_size)
 {
     AVPacket *pkt;
@@ -131,14 +111,9 @@ int audio_decode_frame(AVCodecContext *aCodecCtx, uint8_t *audio_buf, int buf_si
                 fprintf(stderr, "Failed to calculate data size\n");
                 exit(1);
             }
-            for (auto i = 0; i < frame->nb_samples; i++)
-            {
-                for (auto ch = 0; ch < aCodecCtx->ch_layout.nb_channels; ch++)
-                {
-                    memcpy(audio_buf + data_size, frame->data[ch] + sample_size * i, sample_size);
-                    data_size += sample_size;
-                }
-            } });
+            audio_interleave(audio_buf + data_size, frame->extended_data, sample_size, aCodecCtx->ch_layout.nb_channels,
+                             frame->nb_samples);
+            data_size += sample_size * aCodecCtx->ch_layout.nb_channels * frame->nb_samples; });
         av_packet_free(&pkt);
         if (ret == 0)
             break;
@@ -146,22 +121,19 @@ int audio_decode_frame(AVCodecContext *aCodecCtx, uint8_t *audio_buf, int buf_si
     return data_size;
 }
 
-void video_callback(AVCodecContext *codecCtx, AVPacket *pkt, SDL_Renderer *renderer, SDL_Texture *texture)
+void video_callback(AVCodecContext *codecCtx, AVPacket *pkt, SDL_Renderer *renderer, VideoTexture *texture)
 {
     decode(codecCtx, pkt, [&](AVFrame *frame)
            {
 
     // 将YUV数据填充到SDL纹理中
-    SDL_UpdateYUVTexture(texture, NULL,
-                         frame->data[0], frame->linesize[0],
-                         frame->data[1], frame->linesize[1],
-                         frame->data[2], frame->linesize[2]);
+    video_texture_upload(texture, frame);
 
     // 清空渲染器
     SDL_RenderClear(renderer);
 
     // 将纹理复制到渲染器
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderCopy(renderer, texture->texture, NULL, NULL);
 
     // 刷新屏幕
     SDL_RenderPresent(renderer); });
@@ -204,6 +176,112 @@ void audio_callback(void *userdata, Uint8 *stream, int len)
     }
 }
 
+// 改成模板之前的decode：std::function回调，每帧av_frame_alloc/av_frame_free。只留给--bench-decode做对比
+static int decode_legacy(AVCodecContext *dec_ctx, const AVPacket *pkt, std::function<void(AVFrame *)> onFrame)
+{
+    int ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0)
+        return ret;
+    while (ret >= 0)
+    {
+        auto frame = decode_frame_alloc();
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret < 0)
+        {
+            av_frame_free(&frame);
+            break;
+        }
+        onFrame(frame);
+        av_frame_free(&frame);
+    }
+    return ret == AVERROR(EAGAIN) ? 0 : ret;
+}
+
+// 把音频流的packet先读进内存，分别用旧版和模板版decode解码，比较每帧耗时和AVFrame分配次数。
+// 两个版本都经过decode_frame_alloc计数，分配次数是所有轮次加起来的：模板版只有线程第一次解码时分配一次
+// 音频每秒几十上百帧，是每帧固定开销最明显的地方
+static int bench_decode(const char *filename)
+{
+    AVFormatContext *fmt = NULL;
+    const AVCodec *codec = NULL;
+    std::vector<AVPacket *> packets;
+    int stream;
+
+    if (avformat_open_input(&fmt, filename, NULL, NULL) != 0 || avformat_find_stream_info(fmt, NULL) < 0)
+    {
+        fprintf(stderr, "Couldn't open %s\n", filename);
+        return -1;
+    }
+    stream = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0);
+    if (stream < 0)
+    {
+        fprintf(stderr, "No audio stream in %s\n", filename);
+        return -1;
+    }
+    for (;;)
+    {
+        auto pkt = av_packet_alloc();
+        if (av_read_frame(fmt, pkt) < 0)
+        {
+            av_packet_free(&pkt);
+            break;
+        }
+        if (pkt->stream_index == stream)
+            packets.push_back(pkt);
+        else
+            av_packet_free(&pkt);
+    }
+
+    // 交替跑几轮取最快的一次，排除预热和调度的影响
+    int64_t best[2] = {INT64_MAX, INT64_MAX}, allocs[2] = {0, 0}, frames = 0;
+    const int rounds = 3;
+    for (auto round = 0; round < rounds; round++)
+    {
+        for (auto legacy = 0; legacy < 2; legacy++)
+        {
+            auto ctx = avcodec_alloc_context3(codec);
+            avcodec_parameters_to_context(ctx, fmt->streams[stream]->codecpar);
+            if (avcodec_open2(ctx, codec, NULL) < 0)
+                return -1;
+
+            int64_t nb_frames = 0, samples = 0, allocs0 = decode_frame_allocs;
+            auto onFrame = [&](AVFrame *frame)
+            {
+                nb_frames++;
+                samples += frame->nb_samples;
+            };
+            auto t0 = av_gettime_relative();
+            for (size_t i = 0; i <= packets.size(); i++)
+            {
+                auto pkt = i < packets.size() ? packets[i] : nullptr;
+                if (legacy)
+                    decode_legacy(ctx, pkt, onFrame);
+                else
+                    decode(ctx, pkt, onFrame);
+            }
+            auto elapsed = av_gettime_relative() - t0;
+
+            if (elapsed < best[legacy])
+                best[legacy] = elapsed;
+            allocs[legacy] += decode_frame_allocs - allocs0;
+            frames = nb_frames;
+            avcodec_free_context(&ctx);
+        }
+    }
+
+    printf("%s: %zu packets, %" PRId64 " frames, %d runs each\n", codec->name, packets.size(), frames, rounds);
+    const char *names[2] = {"template + reused frame", "std::function + alloc"};
+    for (auto legacy = 0; legacy < 2; legacy++)
+        printf("  %-24s %8.1f ns/frame, %" PRId64 " frame allocs in all runs (%.3f per frame)\n", names[legacy],
+               frames > 0 ? best[legacy] * 1000.0 / frames : 0.0, allocs[legacy],
+               frames > 0 ? allocs[legacy] / (double)(frames * rounds) : 0.0);
+
+    for (auto &pkt : packets)
+        av_packet_free(&pkt);
+    avformat_close_input(&fmt);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     // Initalizing these to NULL prevents segfaults!
@@ -219,6 +297,8 @@ int main(int argc, char *argv[])
         printf("Please provide a movie file\n");
         return -1;
     }
+    if (argc > 2 && strcmp(argv[1], "--bench-decode") == 0)
+        return bench_decode(argv[2]);
 
     // 初始化SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
@@ -243,13 +323,9 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // 创建SDL纹理
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, 640, 480);
-    if (!texture)
-    {
-        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
-        return -1;
-    }
+    // SDL纹理按画面尺寸在第一帧时创建，分辨率变化时重建
+    VideoTexture texture;
+    video_texture_init(&texture, renderer);
 
     // Open video file
     if (avformat_open_input(&pFormatCtx, argv[1], NULL, NULL) != 0)
@@ -374,7 +450,7 @@ int main(int argc, char *argv[])
             // Is this a packet from the video stream?
             if (packet->stream_index == videoStream)
             {
-                video_callback(vCodecCtx, packet, renderer, texture);
+                video_callback(vCodecCtx, packet, renderer, &texture);
             }
             else if (packet->stream_index == audioStream)
             {
@@ -386,7 +462,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            video_callback(vCodecCtx, NULL, renderer, texture);
+            video_callback(vCodecCtx, NULL, renderer, &texture);
         }
     }
     
@@ -401,7 +477,7 @@ int main(int argc, char *argv[])
     avformat_close_input(&pFormatCtx);
 
     // 销毁SDL纹理、渲染器和窗口
-    SDL_DestroyTexture(texture);
+    video_texture_destroy(&texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
@@ -6,6 +6,10 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "audio_interleave.h"
+#include "decode.hpp"
+#include "video_texture.h"
+
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <list>
@@ -31,7 +35,6 @@ extern "C" {
 
 #define VIDEO_PICTURE_QUEUE_SIZE 1
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame);
 void audio_callback(void *userdata, Uint8 *stream, int len);
 
 struct PacketQueue
@@ -228,14 +231,9 @@ struct VideoState
                     fprintf(stderr, "Failed to calculate data size\n");
                     return;
                 }
-                for (auto i = 0; i < frame->nb_samples; i++)
-                {
-                    for (auto ch = 0; ch < audio_ctx->ch_layout.nb_channels; ch++)
-                    {
-                        memcpy(audio_buf + data_size, frame->data[ch] + sample_size * i, sample_size);
-                        data_size += sample_size;
-                    }
-                } });
+                audio_interleave(audio_buf + data_size, frame->extended_data, sample_size, audio_ctx->ch_layout.nb_channels,
+                                 frame->nb_samples);
+                data_size += sample_size * audio_ctx->ch_layout.nb_channels * frame->nb_samples; });
         av_packet_free(&pkt);
 
         return data_size;
@@ -350,32 +348,6 @@ struct VideoState
     }
 };
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame)
-{
-    int ret = AVERROR(1);
-
-    /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0)
-    {
-        fprintf(stderr, "Error submitting the packet to the decoder\n");
-        return ret;
-    }
-
-    /* read all the output frames (in general there may be any number of them */
-    while (ret >= 0)
-    {
-        auto frame = av_frame_alloc();
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret < 0)
-        {
-            break;
-        }
-        onFrame(frame);
-        av_frame_free(&frame);
-    }
-    return ret == AVERROR(EAGAIN) ? 0 : ret;
-}
 
 
 
@@ -461,13 +433,9 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // 创建SDL纹理
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, 640, 480);
-    if (!texture)
-    {
-        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
-        return -1;
-    }
+    // SDL纹理按画面尺寸在第一帧时创建，分辨率变化时重建
+    VideoTexture texture;
+    video_texture_init(&texture, renderer);
 
     auto is = std::make_shared<VideoState>();
     is->Open(argv[1]);
@@ -503,14 +471,11 @@ int main(int argc, char *argv[])
                 }
 
                 // 将YUV数据填充到SDL纹理中
-                SDL_UpdateYUVTexture(texture, NULL,
-                                     frame->data[0], frame->linesize[0],
-                                     frame->data[1], frame->linesize[1],
-                                     frame->data[2], frame->linesize[2]);
+                video_texture_upload(&texture, frame);
                 // 清空渲染器
                 SDL_RenderClear(renderer);
                 // 将纹理复制到渲染器
-                SDL_RenderCopy(renderer, texture, NULL, NULL);
+                SDL_RenderCopy(renderer, texture.texture, NULL, NULL);
                 // 刷新屏幕
                 SDL_RenderPresent(renderer);
 
@@ -522,7 +487,7 @@ int main(int argc, char *argv[])
     }
 
     // 销毁SDL纹理、渲染器和窗口
-    SDL_DestroyTexture(texture);
+    video_texture_destroy(&texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
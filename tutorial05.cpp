@@ -7,6 +7,11 @@ extern "C" {
 #include <libavutil/time.h>
 }
 
+#include "audio_interleave.h"
+#include "decode.hpp"
+#include "video_texture.h"
+#include "decoder_threads.h"
+
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <list>
@@ -14,6 +19,7 @@ extern "C" {
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <getopt.h>
 
 // compatibility with newer API
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
@@ -35,7 +41,6 @@ extern "C" {
 #define AV_SYNC_THRESHOLD 0.01
 #define AV_NOSYNC_THRESHOLD 10.0
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame);
 void audio_callback(void *userdata, Uint8 *stream, int len);
 
 struct PacketQueue
@@ -113,6 +118,8 @@ struct VideoState
 
     bool quit = false;
 
+    DecoderThreads video_threads{}; // 视频解码器的线程配置，命令行指定
+
     double audio_clock = 0.0;
     double video_clock = 0.0;
     double frame_timer = 0.0;
@@ -152,6 +159,9 @@ struct VideoState
         if (videoStream == -1 || audioStream == -1)
             throw std::runtime_error("Didn't find a video or audio stream");
 
+        if (video_threads.tune && decoder_threads_tune(filename.c_str(), videoStream, 3.0, &video_threads) < 0)
+            fprintf(stderr, "Decoder thread tuning failed, using defaults\n");
+
         parse_thread = std::thread([&]
                                    { decode_thread(); });
     }
@@ -257,14 +267,9 @@ struct VideoState
                     fprintf(stderr, "Failed to calculate data size\n");
                     return;
                 }
-                for (auto i = 0; i < frame->nb_samples; i++)
-                {
-                    for (auto ch = 0; ch < audio_ctx->ch_layout.nb_channels; ch++)
-                    {
-                        memcpy(audio_buf + data_size, frame->data[ch] + sample_size * i, sample_size);
-                        data_size += sample_size;
-                    }
-                } 
+                audio_interleave(audio_buf + data_size, frame->extended_data, sample_size, audio_ctx->ch_layout.nb_channels,
+                                 frame->nb_samples);
+                data_size += sample_size * audio_ctx->ch_layout.nb_channels * frame->nb_samples; 
                 // 音频就直接使用pts
                 if(pkt->pts != AV_NOPTS_VALUE) {
                     audio_clock = av_q2d(audio_st->time_base)*pkt->pts;
@@ -325,9 +330,16 @@ struct VideoState
             fprintf(stderr, "Couldn't copy codec context");
             return -1; // Error copying codec context
         }
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+            decoder_threads_apply(codecCtx, &video_threads);
         // 打开解码器
         if (avcodec_open2(codecCtx, codec, NULL) < 0)
             return -1;
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+            fprintf(stderr, "video decoder threads: %d, type %s\n", codecCtx->thread_count,
+                    codecCtx->active_thread_type == FF_THREAD_FRAME   ? "frame"
+                    : codecCtx->active_thread_type == FF_THREAD_SLICE ? "slice"
+                                                                      : "none");
 
         switch (codecCtx->codec_type)
         {
@@ -408,32 +420,6 @@ struct VideoState
     }
 };
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame)
-{
-    int ret = AVERROR(1);
-
-    /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0)
-    {
-        fprintf(stderr, "Error submitting the packet to the decoder\n");
-        return ret;
-    }
-
-    /* read all the output frames (in general there may be any number of them */
-    while (ret >= 0)
-    {
-        auto frame = av_frame_alloc();
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret < 0)
-        {
-            break;
-        }
-        onFrame(frame);
-        av_frame_free(&frame);
-    }
-    return ret == AVERROR(EAGAIN) ? 0 : ret;
-}
 
 
 
@@ -536,7 +522,32 @@ void video_refresh_timer(VideoState *is, std::function<void(AVFrame *)> onDispla
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    static const struct option long_options[] = {
+        {"decoder-threads", required_argument, NULL, 'j'},
+        {"thread-type", required_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0},
+    };
+    DecoderThreads video_threads{};
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "j:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            video_threads.count = atoi(optarg);
+            video_threads.count_set = 1;
+            break;
+        case 'T':
+            if (decoder_threads_parse_type(&video_threads, optarg) == 0)
+                break;
+            // fallthrough
+        default:
+            fprintf(stderr, "Usage: %s [-j N] [--thread-type frame|slice|both|tune] <movie file>\n", argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc)
     {
         printf("Please provide a movie file\n");
         return -1;
@@ -565,16 +576,13 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    // 创建SDL纹理
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, 720, 560);
-    if (!texture)
-    {
-        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
-        return -1;
-    }
+    // SDL纹理按画面尺寸在第一帧时创建，分辨率变化时重建
+    VideoTexture texture;
+    video_texture_init(&texture, renderer);
 
     auto is = std::make_shared<VideoState>();
-    is->Open(argv[1]);
+    is->video_threads = video_threads;
+    is->Open(argv[optind]);
 
     schedule_refresh(is.get(), 40);
 
@@ -603,14 +611,11 @@ int main(int argc, char *argv[])
                 video_refresh_timer(is.get(), [&](AVFrame *frame)
                                     {
                                     // 将YUV数据填充到SDL纹理中
-                    SDL_UpdateYUVTexture(texture, NULL,
-                                        frame->data[0], frame->linesize[0],
-                                        frame->data[1], frame->linesize[1],
-                                        frame->data[2], frame->linesize[2]);
+                    video_texture_upload(&texture, frame);
                     // 清空渲染器
                     SDL_RenderClear(renderer);
                     // 将纹理复制到渲染器
-                    SDL_RenderCopy(renderer, texture, NULL, NULL);
+                    SDL_RenderCopy(renderer, texture.texture, NULL, NULL);
                     // 刷新屏幕
                     SDL_RenderPresent(renderer);
                 });
@@ -619,7 +624,7 @@ int main(int argc, char *argv[])
     }
 
     // 销毁SDL纹理、渲染器和窗口
-    SDL_DestroyTexture(texture);
+    video_texture_destroy(&texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
@@ -2,11 +2,18 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
 #include <libavutil/avutil.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/time.h>
 }
 
+#include "audio_interleave.h"
+#include "decode.hpp"
+#include "decoder_threads.h"
+#include "frame_arena.h"
+#include "video_texture.h"
+
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <list>
@@ -14,7 +21,15 @@ extern "C" {
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <getopt.h>
 #include <iostream>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <errno.h>
+#include <chrono>
+#include <climits>
 
 // compatibility with newer API
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55, 28, 1)
@@ -23,39 +38,178 @@ extern "C" {
 #endif
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
+#define AUDIO_LEAD_MS 100 // 音频解码线程默认提前缓冲的时长
 #define MAX_AUDIO_FRAME_SIZE 192000
 
-#define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
-#define MAX_VIDEOQ_SIZE (5 * 1024 * 1024)
-
-#define FF_REFRESH_EVENT (SDL_USEREVENT)
-#define FF_QUIT_EVENT (SDL_USEREVENT + 1)
+// 包队列按媒体时长限流，字节数只是防止packet没有时长信息时无限增长的保险
+#define MAX_QUEUE_SECONDS 2.0
+#define MAX_AUDIOQ_SIZE (1 * 1024 * 1024)
+#define MAX_VIDEOQ_SIZE (32 * 1024 * 1024)
 
 #define VIDEO_PICTURE_QUEUE_SIZE 5
 
 #define AV_SYNC_THRESHOLD 0.01
 #define AV_NOSYNC_THRESHOLD 10.0
+#define FRAME_TIMER_RESET 0.1 // 显示落后超过这么多秒(暂停、seek之后)，frame_timer从当前时间重新算
+
+#define PRESENT_SPIN_US 1000 // 显示循环睡到截止时间前这么多微秒，剩下的忙等
+#define ALLOC_WARMUP_FRAMES 100 // 视频路径上前这么多帧算预热，之后的分配才算稳态
+#define EVENT_POLL_US 10000 // 显示循环等画面或者等截止时间时，最多隔这么久处理一次窗口事件
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame);
 void audio_callback(void *userdata, Uint8 *stream, int len);
 
 AVPacket flush_pkt;
 
-struct PacketQueue
+// 单调时钟(微秒)，和clock_nanosleep用同一个时钟
+static int64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 复用AVPacket结构体。decode_thread从池里取一个packet交给av_read_frame填充，Put时所有权直接移进队列，
+// 不再clone；消费者用完调用Release，av_packet_unref释放数据后结构体回到空闲列表，留给下一次读取
+struct PacketPool
+{
+    std::mutex mutex;
+    std::vector<AVPacket *> free_list;
+    std::atomic<int64_t> allocs{0};
+    std::atomic<int64_t> acquires{0};
+
+    PacketPool()
+    {
+        free_list.reserve(4096);
+    }
+
+    ~PacketPool()
+    {
+        for (auto &p : free_list)
+            av_packet_free(&p);
+    }
+
+    AVPacket *Acquire()
+    {
+        acquires++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_list.empty())
+            {
+                auto pkt = free_list.back();
+                free_list.pop_back();
+                return pkt;
+            }
+        }
+        allocs++;
+        return av_packet_alloc();
+    }
+
+    void Release(AVPacket *&pkt)
+    {
+        if (!pkt)
+            return;
+        av_packet_unref(pkt);
+        std::lock_guard<std::mutex> lock(mutex);
+        free_list.push_back(pkt);
+        pkt = nullptr;
+    }
+} packet_pool;
+
+// 解包线程的背压：队列够了就在这里等，消费者每取走一个packet调用Signal，只有解包线程真的在等时才加锁通知
+struct DemuxThrottle
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> waiting{false};
+
+    void Signal()
+    {
+        if (waiting)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_one();
+        }
+    }
+
+    // seek、退出等不是消费者引起的状态变化
+    void Wake()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cond.notify_all();
+    }
+
+    template <typename Pred>
+    void WaitUntil(Pred pred)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting = true; // seq_cst，和消费者先改size/duration再读waiting配对，不会丢唤醒
+        cond.wait(lock, pred);
+        waiting = false;
+    }
+};
+
+// 两种包队列共用的统计：字节数和媒体时长(流的time_base单位)。
+// 没有duration的packet用default_duration估算(视频一帧、音频一个frame_size)，flush这类空packet不计
+struct PacketQueueStats
+{
+    std::atomic<int> size{0};
+    std::atomic<int64_t> duration{0};
+    AVRational time_base{1, 1};
+    int64_t default_duration = 0;
+    DemuxThrottle *throttle = nullptr;
+
+    int64_t DurationOf(const AVPacket *pkt) const
+    {
+        if (pkt->size <= 0)
+            return 0;
+        return pkt->duration > 0 ? pkt->duration : default_duration;
+    }
+
+    void Added(const AVPacket *pkt)
+    {
+        Added(pkt->size, DurationOf(pkt));
+    }
+
+    void Added(int bytes, int64_t dur)
+    {
+        size += bytes;
+        duration += dur;
+    }
+
+    void Removed(const AVPacket *pkt)
+    {
+        Removed(pkt->size, DurationOf(pkt));
+    }
+
+    void Removed(int bytes, int64_t dur)
+    {
+        size -= bytes;
+        duration -= dur;
+        if (throttle)
+            throttle->Signal();
+    }
+
+    double Seconds() const
+    {
+        return duration * av_q2d(time_base);
+    }
+};
+
+struct PacketQueue : PacketQueueStats
 {
     std::list<AVPacket *> plist;
     int nb_packets = 0;
-    int size = 0;
     std::mutex mutex;
     std::condition_variable cond;
     bool eof = false;
 
-    int Put(const AVPacket *pkt)
+    // pkt的所有权交给队列
+    int Put(AVPacket *pkt)
     {
         std::unique_lock<std::mutex> lock(mutex);
-            plist.push_back(av_packet_clone(pkt));
+        plist.push_back(pkt);
         nb_packets++;
-        size += pkt->size;
+        Added(pkt);
         cond.notify_one();
         return 0;
     }
@@ -70,7 +224,7 @@ struct PacketQueue
             {
                 ret = plist.front();
                 plist.pop_front();
-                size -= ret->size;
+                Removed(ret);
                 nb_packets--;
                 break;
             }
@@ -80,25 +234,746 @@ struct PacketQueue
             }
             cond.wait(lock, [&]() { return !plist.empty() || eof; });
         }
-        return ret;
+        return ret;
+    }
+
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto &p : plist)
+            packet_pool.Release(p);
+        plist.clear();
+        size = 0;
+        duration = 0;
+        nb_packets = 0;
+        if (throttle)
+            throttle->Signal();
+    }
+
+    // 设置结束标记并唤醒等待的Get
+    void SetEof()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        eof = true;
+        cond.notify_all();
+    }
+
+    // 链表没有容量上限，只受字节数和时长限制
+    bool NearlyFull() const
+    {
+        return false;
+    }
+};
+
+// 单生产者(decode_thread)单消费者(视频/音频解码线程)的无锁环形队列，接口和PacketQueue一样。
+// Put/Get在队列非空非满时只有几次原子读写，不加锁也不分配链表节点；
+// 只有队列真的空了(消费者)或满了(生产者)才在条件变量上等待，另一方看到有人在等才去加锁通知。
+// Flush由生产者调用，不能直接释放消费者那一端的packet，所以改为递增serial：
+// 每个槽位记录写入时的serial，Get遇到旧serial的packet直接释放跳过，效果和清空队列一样。
+// 统计不能等消费者取到旧packet再扣(消费者可能正停着，比如暂停时的音频)，Flush当场扣掉；
+// 每个槽位有一个counted标记，Flush和Get谁先exchange到true谁来扣，同一个packet只扣一次。
+struct RingPacketQueue : PacketQueueStats
+{
+    static constexpr size_t CAPACITY = 1024; // 必须是2的幂
+    // 解包线程每读一个packet检查一次队列，留几个槽位给seek时的flush packet，正常情况下Put不会阻塞
+    static constexpr size_t FULL_MARGIN = 16;
+
+    struct Slot
+    {
+        AVPacket *pkt;
+        int serial;
+        // 放进来时算好的统计，Flush扣统计时不碰可能已经被消费者释放的packet
+        int size;
+        int64_t duration;
+        std::atomic<bool> counted;
+    };
+    Slot ring[CAPACITY];
+    alignas(64) std::atomic<size_t> head{0}; // 只有消费者写
+    alignas(64) std::atomic<size_t> tail{0}; // 只有生产者写
+    std::atomic<int> serial{0};
+    std::atomic<bool> eof{false};
+
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+    std::atomic<bool> consumer_waiting{false}, producer_waiting{false};
+
+    ~RingPacketQueue()
+    {
+        for (auto h = head.load(); h != tail.load(); h++)
+            packet_pool.Release(ring[h % CAPACITY].pkt);
+    }
+
+    // pkt的所有权交给队列。满了就等，设置eof(退出)后不再等，直接释放pkt返回-1
+    int Put(AVPacket *pkt)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == CAPACITY)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            producer_waiting = true;
+            not_full.wait(lock, [&]() { return t - head.load() < CAPACITY || eof.load(); });
+            producer_waiting = false;
+            if (t - head.load() == CAPACITY)
+            {
+                packet_pool.Release(pkt);
+                return -1;
+            }
+        }
+
+        auto &slot = ring[t % CAPACITY];
+        slot.pkt = pkt;
+        slot.serial = serial.load(std::memory_order_relaxed);
+        slot.size = pkt->size;
+        slot.duration = DurationOf(pkt);
+        slot.counted.store(true, std::memory_order_relaxed);
+        Added(slot.size, slot.duration);
+        tail.store(t + 1); // seq_cst，和下面读consumer_waiting构成Dekker式的握手，不会丢唤醒
+        if (consumer_waiting)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.notify_one();
+        }
+        return 0;
+    }
+
+    AVPacket *Get(bool block = true)
+    {
+        for (;;)
+        {
+            auto h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire))
+            {
+                // 先看eof再确认一次是否为空，生产者总是先Put再设eof
+                if (!block || (eof.load() && h == tail.load()))
+                    return nullptr;
+                std::unique_lock<std::mutex> lock(mutex);
+                consumer_waiting = true;
+                not_empty.wait(lock, [&]() { return h != tail.load() || eof.load(); });
+                consumer_waiting = false;
+                continue;
+            }
+
+            // head前移之后生产者就可能覆盖这个槽位，先把要用的都读出来
+            auto &slot = ring[h % CAPACITY];
+            auto pkt = slot.pkt;
+            auto pkt_serial = slot.serial;
+            auto bytes = slot.size;
+            auto dur = slot.duration;
+            auto counted = slot.counted.exchange(false);
+            head.store(h + 1);
+            if (counted)
+                Removed(bytes, dur);
+            if (producer_waiting)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_full.notify_one();
+            }
+            // Flush之前放进来的packet
+            if (pkt_serial != serial.load(std::memory_order_acquire))
+            {
+                packet_pool.Release(pkt);
+                continue;
+            }
+            return pkt;
+        }
+    }
+
+    void Flush()
+    {
+        serial.fetch_add(1, std::memory_order_release);
+        // 队列里的旧packet马上从统计里扣掉，解包线程的节流不用等消费者把它们取走
+        int bytes = 0;
+        int64_t dur = 0;
+        for (auto h = head.load(); h != tail.load(std::memory_order_relaxed); h++)
+        {
+            auto &slot = ring[h % CAPACITY];
+            if (slot.counted.exchange(false))
+            {
+                bytes += slot.size;
+                dur += slot.duration;
+            }
+        }
+        Removed(bytes, dur);
+    }
+
+    void SetEof()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        eof = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    // 占着的槽位数，包括Flush之后还没被消费者释放的旧packet：Put能不能放进去看的是槽位
+    int nb_packets() const
+    {
+        return (int)(tail.load() - head.load());
+    }
+
+    bool NearlyFull() const
+    {
+        return nb_packets() >= (int)(CAPACITY - FULL_MARGIN);
+    }
+};
+
+// 默认用无锁队列，定义LOCKED_PACKET_QUEUE可以换回加锁的链表队列做对比
+#ifdef LOCKED_PACKET_QUEUE
+using MediaPacketQueue = PacketQueue;
+#else
+using MediaPacketQueue = RingPacketQueue;
+#endif
+
+// pictq的一个槽位。槽位和里面的AVFrame在VideoState构造时一次分配好，之后只做引用的移入和释放
+struct VideoPicture
+{
+    AVFrame *frame = nullptr;
+    double pts = 0;
+};
+
+// 一对(位置或时间, pts)的无锁发布，用seqlock：只有一个写者，读者碰到写了一半就重读。
+// 音频回调是读者或写者之一，不能用mutex
+struct PtsAnchor
+{
+    std::atomic<uint32_t> seq{0};
+    std::atomic<int64_t> at{0};
+    std::atomic<double> pts{0};
+
+    void Store(int64_t a, double p)
+    {
+        auto s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        at.store(a, std::memory_order_relaxed);
+        pts.store(p, std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    void Load(int64_t &a, double &p) const
+    {
+        for (;;)
+        {
+            auto s = seq.load(std::memory_order_acquire);
+            if (s & 1)
+                continue;
+            a = at.load(std::memory_order_relaxed);
+            p = pts.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s)
+                return;
+        }
+    }
+};
+
+// 音频解码线程(生产者)和SDL音频回调(消费者)之间的无锁PCM环形缓冲，位置按字节单调递增。
+// 回调里只有几次原子操作和memcpy，不加锁；生产者缓冲够了就在reads上atomic::wait，回调每读一次notify一下。
+// seek时生产者不能动head，所以用Discard记下当时的tail，回调下一次Read直接跳过去
+struct PcmRing
+{
+    static constexpr size_t NO_DISCARD = SIZE_MAX;
+
+    std::vector<uint8_t> data;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0}; // 只有消费者写
+    alignas(64) std::atomic<size_t> tail{0}; // 只有生产者写
+    std::atomic<size_t> discard_to{NO_DISCARD};
+    std::atomic<uint32_t> reads{0};
+
+    // 容量取不小于min_capacity的2的幂
+    void Init(size_t min_capacity)
+    {
+        size_t capacity = 4096;
+        while (capacity < min_capacity)
+            capacity <<= 1;
+        data.assign(capacity, 0);
+        mask = capacity - 1;
+    }
+
+    size_t Capacity() const
+    {
+        return data.size();
+    }
+
+    size_t Available() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    // 生产者：写入最多len字节，返回实际写入的字节数
+    size_t Write(const uint8_t *src, size_t len)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto n = std::min(len, Capacity() - (t - head.load(std::memory_order_acquire)));
+        auto first = std::min(n, Capacity() - (t & mask));
+        memcpy(data.data() + (t & mask), src, first);
+        memcpy(data.data(), src + first, n - first);
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // 消费者：读出最多len字节，返回实际读到的字节数
+    size_t Read(uint8_t *dst, size_t len)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        auto d = discard_to.exchange(NO_DISCARD, std::memory_order_acquire);
+        if (d != NO_DISCARD && d > h)
+            h = d;
+        auto n = std::min(len, tail.load(std::memory_order_acquire) - h);
+        auto first = std::min(n, Capacity() - (h & mask));
+        memcpy(dst, data.data() + (h & mask), first);
+        memcpy(dst + first, data.data(), n - first);
+        head.store(h + n, std::memory_order_release);
+        reads.fetch_add(1, std::memory_order_release);
+        reads.notify_one();
+        return n;
+    }
+
+    // 生产者：丢掉已经写入但还没播放的数据
+    void Discard()
+    {
+        discard_to.store(tail.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    // 生产者：seen是等待前读到的reads，回调又读过一次(或者Wake)才返回
+    void WaitRead(uint32_t seen)
+    {
+        reads.wait(seen, std::memory_order_acquire);
+    }
+
+    void Wake()
+    {
+        reads.fetch_add(1);
+        reads.notify_all();
+    }
+};
+
+// 音频转换：解码器输出的任意格式、采样率、声道布局 -> 设备实际给的spec(packed)。
+// 输入和设备只差planar/packed时直接用audio_interleave，否则走libswresample。
+// SwrContext只在输入参数变化时重建，输出直接写进调用者的缓冲，不另外分配
+struct AudioConverter
+{
+    SwrContext *swr = nullptr;
+    AVSampleFormat out_fmt = AV_SAMPLE_FMT_NONE;
+    int out_rate = 0;
+    AVChannelLayout out_layout{};
+    int out_frame_size = 0; // 一个样本所有声道的字节数
+
+    AVSampleFormat in_fmt = AV_SAMPLE_FMT_NONE;
+    int in_rate = 0;
+    AVChannelLayout in_layout{};
+    bool passthrough = false;
+
+    // 转换耗时和输出的样本数，退出时换算成每秒音频的开销
+    int64_t convert_us = 0;
+    int64_t out_samples = 0;
+    int setups = 0;
+
+    ~AudioConverter()
+    {
+        swr_free(&swr);
+        av_channel_layout_uninit(&in_layout);
+        av_channel_layout_uninit(&out_layout);
+    }
+
+    // 按解码器的格式挑一个SDL能直接播放的格式，SDL不支持的(double等)用float
+    static SDL_AudioFormat ToSDL(AVSampleFormat format)
+    {
+        switch (av_get_packed_sample_fmt(format))
+        {
+        case AV_SAMPLE_FMT_U8:
+            return AUDIO_U8;
+        case AV_SAMPLE_FMT_S16:
+            return AUDIO_S16SYS;
+        case AV_SAMPLE_FMT_S32:
+            return AUDIO_S32SYS;
+        default:
+            return AUDIO_F32SYS;
+        }
+    }
+
+    static AVSampleFormat FromSDL(SDL_AudioFormat format)
+    {
+        switch (format)
+        {
+        case AUDIO_U8:
+            return AV_SAMPLE_FMT_U8;
+        case AUDIO_S16SYS:
+            return AV_SAMPLE_FMT_S16;
+        case AUDIO_S32SYS:
+            return AV_SAMPLE_FMT_S32;
+        case AUDIO_F32SYS:
+            return AV_SAMPLE_FMT_FLT;
+        default:
+            return AV_SAMPLE_FMT_NONE;
+        }
+    }
+
+    // spec是SDL_OpenAudio实际给的设备参数，可能和请求的不一样
+    int Open(const SDL_AudioSpec &spec)
+    {
+        out_fmt = FromSDL(spec.format);
+        if (out_fmt == AV_SAMPLE_FMT_NONE)
+        {
+            fprintf(stderr, "Unsupported device audio format 0x%x\n", spec.format);
+            return -1;
+        }
+        out_rate = spec.freq;
+        av_channel_layout_uninit(&out_layout);
+        av_channel_layout_default(&out_layout, spec.channels);
+        out_frame_size = av_get_bytes_per_sample(out_fmt) * spec.channels;
+        return 0;
+    }
+
+    int BytesPerSecond() const
+    {
+        return out_rate * out_frame_size;
+    }
+
+    // 重采样器里还没输出的样本对应的时长
+    double DelaySeconds() const
+    {
+        return swr ? swr_get_delay(swr, 1000000) / 1000000.0 : 0.0;
+    }
+
+    // 输入参数和上一帧一样时什么都不做，流中途换了格式或采样率才重建
+    int Setup(const AVFrame *frame)
+    {
+        AVChannelLayout layout{};
+        if (frame->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+            av_channel_layout_default(&layout, frame->ch_layout.nb_channels);
+        else
+            av_channel_layout_copy(&layout, &frame->ch_layout);
+
+        if (frame->format == in_fmt && frame->sample_rate == in_rate && !av_channel_layout_compare(&layout, &in_layout))
+        {
+            av_channel_layout_uninit(&layout);
+            return 0;
+        }
+
+        swr_free(&swr);
+        av_channel_layout_uninit(&in_layout);
+        in_layout = layout;
+        in_fmt = (AVSampleFormat)frame->format;
+        in_rate = frame->sample_rate;
+        setups++;
+        passthrough = in_rate == out_rate && av_get_packed_sample_fmt(in_fmt) == out_fmt &&
+                      !av_channel_layout_compare(&in_layout, &out_layout);
+
+        char in_desc[64], out_desc[64];
+        av_channel_layout_describe(&in_layout, in_desc, sizeof(in_desc));
+        av_channel_layout_describe(&out_layout, out_desc, sizeof(out_desc));
+        fprintf(stderr, "audio convert: %s %dHz %s -> %s %dHz %s (%s)\n", av_get_sample_fmt_name(in_fmt), in_rate,
+                in_desc, av_get_sample_fmt_name(out_fmt), out_rate, out_desc, passthrough ? "interleave" : "swresample");
+        if (passthrough)
+            return 0;
+
+        if (swr_alloc_set_opts2(&swr, &out_layout, out_fmt, out_rate, &in_layout, in_fmt, in_rate, 0, nullptr) < 0 ||
+            swr_init(swr) < 0)
+        {
+            fprintf(stderr, "Couldn't initialize the audio resampler\n");
+            swr_free(&swr);
+            in_fmt = AV_SAMPLE_FMT_NONE; // 下一帧再试
+            return -1;
+        }
+        return 0;
+    }
+
+    // 转换一帧写到dst，返回写入的字节数。重采样时dst放不下的样本留在SwrContext里，下次一起输出
+    int Convert(const AVFrame *frame, uint8_t *dst, int dst_size)
+    {
+        if (Setup(frame) < 0)
+            return -1;
+
+        auto t0 = av_gettime_relative();
+        int samples;
+        if (passthrough)
+        {
+            samples = std::min(frame->nb_samples, dst_size / out_frame_size);
+            if (av_sample_fmt_is_planar(in_fmt))
+                audio_interleave(dst, frame->extended_data, av_get_bytes_per_sample(in_fmt), in_layout.nb_channels,
+                                 samples);
+            else
+                memcpy(dst, frame->data[0], samples * out_frame_size);
+        }
+        else
+        {
+            samples = swr_convert(swr, &dst, dst_size / out_frame_size, (const uint8_t **)frame->extended_data,
+                                  frame->nb_samples);
+            if (samples < 0)
+                return -1;
+        }
+        convert_us += av_gettime_relative() - t0;
+        out_samples += samples;
+        return samples * out_frame_size;
+    }
+
+    void PrintStats() const
+    {
+        if (out_samples == 0)
+            return;
+        double seconds = (double)out_samples / out_rate;
+        printf("audio convert: %.1f s of audio, %.3f ms per second of audio, %d setups\n", seconds,
+               convert_us / 1000.0 / seconds, setups);
+    }
+};
+
+// 解码跟不上时让解码器少解一些帧：最近WINDOW帧里超过1/4是饿着(显示时pictq已经空了)或者晚了，就升一级
+// (DEFAULT -> NONREF -> BIDIR)；一整个窗口都正常再降一级。每次判断后重新统计一个窗口，避免来回跳。
+// 显示循环调用Update，解码线程在送包前读Discard
+struct FrameSkipController
+{
+    static constexpr int WINDOW = 32;
+    static constexpr AVDiscard levels[] = {AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_BIDIR};
+    static constexpr int nb_levels = sizeof(levels) / sizeof(levels[0]);
+
+    bool enabled = true;
+    std::atomic<int> level{0};
+    int frames = 0, starved = 0;
+
+    void Update(bool frame_starved)
+    {
+        if (!enabled)
+            return;
+        frames++;
+        starved += frame_starved;
+        if (frames < WINDOW)
+            return;
+
+        auto l = level.load();
+        if (starved * 4 > WINDOW && l < nb_levels - 1)
+            l++;
+        else if (starved == 0 && l > 0)
+            l--;
+        if (l != level)
+        {
+            fprintf(stderr, "frame skip: %d/%d frames starved, skip_frame -> %s\n", starved, frames,
+                    l == 0 ? "default" : l == 1 ? "nonref" : "bidir");
+            level = l;
+        }
+        frames = starved = 0;
+    }
+
+    AVDiscard Discard() const
+    {
+        return levels[level.load(std::memory_order_relaxed)];
+    }
+};
+
+// 解码速度跟不上时逐级换更便宜的解码设置，有余量了再一级级恢复。
+// 指标是解码线程每帧的忙碌时间(不算等pictq空位的时间)和帧间隔的比，margin = 1 - 忙碌时间/帧间隔。
+// 每WINDOW帧判断一次：margin低于DEGRADE_MARGIN就降一级；连续recover_windows个窗口都高于RECOVER_MARGIN才升一级。
+// 刚恢复不久又不得不降级，说明上一级确实撑不住，下次恢复要等的窗口数翻倍，避免来回跳。只在解码线程里用
+struct QualityController
+{
+    static constexpr int WINDOW = 30;
+    static constexpr double DEGRADE_MARGIN = 0.10;
+    static constexpr double RECOVER_MARGIN = 0.35;
+    static constexpr int MAX_RECOVER_WINDOWS = 48;
+
+    struct Level
+    {
+        const char *name;
+        AVDiscard skip_loop_filter;
+        AVDiscard skip_idct;
+        bool fast;
+    };
+    // 越往后越便宜，画质损失也越大
+    static constexpr Level levels[] = {
+        {"full", AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, false},
+        {"skip_loop_filter=nonref", AVDISCARD_NONREF, AVDISCARD_DEFAULT, false},
+        {"skip_loop_filter=all", AVDISCARD_ALL, AVDISCARD_DEFAULT, false},
+        {"skip_loop_filter=all flags2=fast", AVDISCARD_ALL, AVDISCARD_DEFAULT, true},
+        {"skip_loop_filter=all flags2=fast skip_idct=nonref", AVDISCARD_ALL, AVDISCARD_NONREF, true},
+    };
+    static constexpr int nb_levels = sizeof(levels) / sizeof(levels[0]);
+
+    bool enabled = true;
+    double frame_interval = 0; // 秒，0表示不知道帧率，不调整
+    int level = 0;
+    int64_t busy_us = 0;
+    int frames = 0;
+    int good_windows = 0;
+    int recover_windows = 3;
+    int windows_since_recover = INT_MAX;
+    int transitions = 0;
+
+    void Apply(AVCodecContext *ctx) const
+    {
+        ctx->skip_loop_filter = levels[level].skip_loop_filter;
+        ctx->skip_idct = levels[level].skip_idct;
+        if (levels[level].fast)
+            ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+        else
+            ctx->flags2 &= ~AV_CODEC_FLAG2_FAST;
+    }
+
+    void Change(AVCodecContext *ctx, int to, double margin)
+    {
+        fprintf(stderr, "quality: %s -> %s, decode %.1f ms/frame vs %.1f ms interval, margin %+.0f%%\n",
+                levels[level].name, levels[to].name, (double)busy_us / frames / 1000, frame_interval * 1000,
+                margin * 100);
+        level = to;
+        transitions++;
+        Apply(ctx);
+    }
+
+    // 每个包解完调用一次：busy是这次的忙碌时间(微秒)，nb_frames是解出来的帧数
+    void Update(AVCodecContext *ctx, int64_t busy, int nb_frames)
+    {
+        if (!enabled || frame_interval <= 0)
+            return;
+        busy_us += busy;
+        frames += nb_frames;
+        if (frames < WINDOW)
+            return;
+
+        auto margin = 1.0 - (double)busy_us / frames / (frame_interval * 1000000);
+        if (windows_since_recover < INT_MAX)
+            windows_since_recover++;
+        if (margin < DEGRADE_MARGIN)
+        {
+            good_windows = 0;
+            if (level < nb_levels - 1)
+            {
+                if (windows_since_recover <= 2 * recover_windows)
+                    recover_windows = std::min(recover_windows * 2, MAX_RECOVER_WINDOWS);
+                Change(ctx, level + 1, margin);
+            }
+        }
+        else if (margin > RECOVER_MARGIN && level > 0)
+        {
+            if (++good_windows >= recover_windows)
+            {
+                Change(ctx, level - 1, margin);
+                good_windows = 0;
+                windows_since_recover = 0;
+            }
+        }
+        else
+        {
+            good_windows = 0;
+        }
+        busy_us = 0;
+        frames = 0;
+    }
+};
+
+// 预览模式(--preview)：监控墙上画面只按窗口大小显示，没必要按原尺寸解码再让SDL_RenderCopy缩小。
+// 解码器支持lowres时直接输出1/2、1/4、1/8尺寸；不支持时解码后马上用sws缩到窗口大小再进pictq，
+// 后面的纹理上传都只处理小图。Scale只在解码线程里调用
+struct PreviewScaler
+{
+    bool enabled = false;
+    int max_width = 0, max_height = 0; // 窗口大小
+    int lowres = 0;
+    int width = 0, height = 0; // sws缩放的目标尺寸，0表示不缩放
+    SwsContext *sws = nullptr;
+    AVBufferPool *pool = nullptr;
+    AVFrame *scaled = nullptr;
+    int64_t scaled_frames = 0;
+    static inline std::atomic<int64_t> buffer_allocs{0}; // pool里新分配的缓冲数，pool够用后不再增长
+
+    static AVBufferRef *alloc_buffer(size_t size)
+    {
+        buffer_allocs++;
+        return av_buffer_alloc(size);
+    }
+
+    ~PreviewScaler()
+    {
+        sws_freeContext(sws);
+        av_frame_free(&scaled);
+        av_buffer_pool_uninit(&pool); // 还在pictq里的缓冲引用计数归零后才真正释放
+    }
+
+    // avcodec_open2之前调用，按码流尺寸和窗口大小决定lowres级数或者缩放尺寸
+    void Setup(AVCodecContext *ctx, const AVCodec *codec)
+    {
+        if (!enabled || ctx->width <= 0 || ctx->height <= 0)
+            return;
+        auto scale = std::min((double)max_width / ctx->width, (double)max_height / ctx->height);
+        if (scale >= 1)
+            return;
+
+        if (codec->max_lowres > 0)
+        {
+            // 每级宽高减半，取解出来仍不小于窗口的最大级数，剩下的一点交给SDL_RenderCopy
+            while (lowres < codec->max_lowres && 1.0 / (2 << lowres) >= scale)
+                lowres++;
+            ctx->lowres = lowres;
+            fprintf(stderr, "preview: %s lowres=%d, decoding %dx%d instead of %dx%d\n", codec->name, lowres,
+                    AV_CEIL_RSHIFT(ctx->width, lowres), AV_CEIL_RSHIFT(ctx->height, lowres), ctx->width,
+                    ctx->height);
+            return;
+        }
+
+        width = std::max(2, (int)(ctx->width * scale) & ~1);
+        height = std::max(2, (int)(ctx->height * scale) & ~1);
+        pool = av_buffer_pool_init(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, width, height, 32), alloc_buffer);
+        scaled = av_frame_alloc();
+        fprintf(stderr, "preview: %s has no lowres, scaling %dx%d to %dx%d after decode\n", codec->name,
+                ctx->width, ctx->height, width, height);
     }
 
-    void Flush()
+    // 返回缩小后的帧(缓冲来自pool，原帧已unref)；不需要缩放或者失败时原样返回
+    AVFrame *Scale(AVFrame *frame)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        for (auto &p : plist)
-            av_packet_free(&p);
-        plist.clear();
-        size = 0;
-        nb_packets = 0;
+        if (!width)
+            return frame;
+        sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format, width, height,
+                                   AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+        auto buf = sws ? av_buffer_pool_get(pool) : nullptr;
+        if (!buf)
+            return frame;
+
+        av_frame_unref(scaled);
+        scaled->buf[0] = buf;
+        av_image_fill_arrays(scaled->data, scaled->linesize, buf->data, AV_PIX_FMT_YUV420P, width, height, 32);
+        scaled->format = AV_PIX_FMT_YUV420P;
+        scaled->width = width;
+        scaled->height = height;
+        av_frame_copy_props(scaled, frame);
+        sws_scale(sws, frame->data, frame->linesize, 0, frame->height, scaled->data, scaled->linesize);
+        av_frame_unref(frame); // 原尺寸的画面马上还给解码器
+        scaled_frames++;
+        return scaled;
     }
 };
 
-struct VideoPicture
+// A/V偏差(画面pts - 音频时钟，单位秒)的分布：均值、标准差、分位数，再按10ms一档画个直方图
+static void print_av_offsets(const char *name, std::vector<double> offsets)
 {
-    AVFrame *frame;
-    double pts;
-};
+    if (offsets.empty())
+        return;
+    std::sort(offsets.begin(), offsets.end());
+    double sum = 0, sum2 = 0;
+    for (auto v : offsets)
+    {
+        sum += v;
+        sum2 += v * v;
+    }
+    auto n = offsets.size();
+    auto mean = sum / n;
+    auto pct = [&](int p)
+    { return offsets[std::min(n - 1, n * p / 100)] * 1000; };
+    printf("A/V offset (%s clock): %zu frames, mean %+.1f ms, stddev %.1f ms, p1 %+.1f, p50 %+.1f, p99 %+.1f, "
+           "min %+.1f, max %+.1f ms\n",
+           name, n, mean * 1000, sqrt(std::max(0.0, sum2 / n - mean * mean)) * 1000, pct(1), pct(50), pct(99),
+           offsets.front() * 1000, offsets.back() * 1000);
+
+    const int buckets = 10, width_ms = 10; // ±100ms，超出的算进两端
+    int hist[2 * buckets] = {};
+    for (auto v : offsets)
+        hist[std::clamp((int)floor(v * 1000 / width_ms) + buckets, 0, 2 * buckets - 1)]++;
+    for (auto i = 0; i < 2 * buckets; i++)
+    {
+        if (!hist[i])
+            continue;
+        printf("  %+4d ms %6.2f%% ", (i - buckets) * width_ms, 100.0 * hist[i] / n);
+        for (auto k = 0; k < hist[i] * 50 / (int)n; k++)
+            putchar('#');
+        putchar('\n');
+    }
+}
 
 struct VideoState
 {
@@ -106,34 +981,91 @@ struct VideoState
     int videoStream = -1, audioStream = -1;
     AVStream *audio_st = nullptr;
     AVCodecContext *audio_ctx = nullptr;
-    PacketQueue audioq;
+    MediaPacketQueue audioq;
     AVStream *video_st = nullptr;
     AVCodecContext *video_ctx = nullptr;
-    PacketQueue videoq;
+    MediaPacketQueue videoq;
+    DemuxThrottle demux_throttle;
+    double queue_seconds = MAX_QUEUE_SECONDS;
 
-    VideoPicture *pictq[VIDEO_PICTURE_QUEUE_SIZE];
+    VideoPicture pictq[VIDEO_PICTURE_QUEUE_SIZE];
     int pictq_size = 0, pictq_rindex = 0, pictq_windex = 0;
     std::mutex pictq_mutex;
     std::condition_variable pictq_cond;
+    // 视频路径上的计数：解码放进pictq的和真正显示了的帧数
+    std::atomic<int64_t> pictq_pushed{0};
+    std::atomic<int64_t> pictq_displayed{0};
+    // 视频路径上的分配：解码器从默认分配器拿的缓冲(开了arena就是arena的fallbacks)、解码输出AVFrame、
+    // 预览缩放pool新分配的缓冲。第ALLOC_WARMUP_FRAMES帧放进pictq时记下一份，退出时的差值就是稳态下的分配次数
+    struct VideoAllocs
+    {
+        int64_t buffers, frames, preview;
+    };
+    std::atomic<int64_t> default_buffers{0};
+    VideoAllocs warm_allocs{};
+    // 负载过高时的计数：显示前丢掉的、解码器跳过的(跳帧期间没出帧的包数)、落后音频还是显示了的
+    FrameSkipController frame_skip;
+    std::atomic<int64_t> frames_dropped{0};
+    std::atomic<int64_t> frames_skipped{0};
+    std::atomic<int64_t> frames_late{0};
+    QualityController quality;
+    PreviewScaler preview;
+    bool upload_lock = false; // --upload lock：纹理用SDL_LockTexture上传
+    int64_t pictq_wait_us = 0; // 解码线程等pictq空位的累计时间，算解码忙碌时间时扣掉
 
     std::thread parse_thread;
     std::thread video_thread;
+    std::thread audio_thread;
 
     bool quit = false;
 
-    double audio_clock = 0.0;
+    DecoderThreads video_threads{}; // 视频解码器的线程配置，命令行指定
+    int arena_frames = 0;           // >0时视频画面从FrameArena分配
+    bool arena_hugepages = false;
+    FrameArena *arena = nullptr;
+
+    // 音频时钟。audio_clock是已经写进pcm_ring的数据末尾的pts；
+    // audio_anchor把pcm_ring的字节位置和pts对应起来(解码线程写)，audio_clock_sample是回调时刻正在播放的pts(回调写)
+    std::atomic<double> audio_clock{0.0};
+    double audio_next_pts = 0.0;
+    PtsAnchor audio_anchor;
+    PtsAnchor audio_clock_sample;
+    size_t audio_hw_buf_size = 0; // 设备里除了刚交出去的数据，还排着的一个缓冲
+    double audio_period = 0.0;    // 两次回调的间隔
+
+    // --av-offset：每显示一帧记录画面pts和两种音频时钟的差，退出时打印分布。只在主线程的显示循环里访问
+    bool measure_av_offset = false;
+    std::vector<double> av_offsets, av_offsets_naive;
     double video_clock = 0.0;
     double frame_timer = 0.0;
     double frame_last_pts = 0.0;
     double frame_last_delay = 0.0;
-    size_t audio_buf_size = 0;
-    size_t audio_buf_index = 0;
     uint8_t audio_buf[(MAX_AUDIO_FRAME_SIZE * 3) / 2];
+    AudioConverter audio_conv; // audio_buf里是转换后的设备格式
+
+    // 音频解码线程把转换好的PCM写进pcm_ring，始终保持audio_lead_ms毫秒的余量，回调只从里面拷贝
+    PcmRing pcm_ring;
+    int audio_lead_ms = AUDIO_LEAD_MS;
+    size_t audio_lead_bytes = 0;
+    uint8_t audio_silence = 0;
+    std::atomic<bool> audio_eof{false};
+    // 回调里的计数：回调次数、数据不够(欠载)的次数和补的静音字节数
+    std::atomic<int64_t> audio_callbacks{0};
+    std::atomic<int64_t> audio_underruns{0};
+    std::atomic<int64_t> audio_underrun_bytes{0};
 
     int seek_req;
     int seek_flags;
     int64_t seek_pos;
 
+    VideoState()
+    {
+        audioq.throttle = &demux_throttle;
+        videoq.throttle = &demux_throttle;
+        for (auto &vp : pictq)
+            vp.frame = av_frame_alloc();
+    }
+
     void Open(const std::string &filename)
     {
         // Open video file
@@ -164,22 +1096,67 @@ struct VideoState
         if (videoStream == -1 || audioStream == -1)
             throw std::runtime_error("Didn't find a video or audio stream");
 
+        if (video_threads.tune && decoder_threads_tune(filename.c_str(), videoStream, 3.0, &video_threads) < 0)
+            fprintf(stderr, "Decoder thread tuning failed, using defaults\n");
+
         parse_thread = std::thread([&]
                                    { decode_thread(); });
     }
 
     ~VideoState()
     {
+        // 先让所有线程退出：线程还joinable时析构std::thread会直接terminate，后面的统计也打印不出来
+        request_quit();
+        SDL_CloseAudio();
+        audioq.SetEof();
+        videoq.SetEof();
+        for (auto t : {&parse_thread, &video_thread, &audio_thread})
+            if (t->joinable())
+                t->join();
+
         avformat_close_input(&pFormatCtx);
         avformat_free_context(pFormatCtx);
 
         avcodec_free_context(&audio_ctx);
         avcodec_free_context(&video_ctx);
-        for (auto &p : pictq)
+        if (arena)
+            frame_arena_print_stats(arena);
+        audio_conv.PrintStats();
+        print_av_offsets("compensated", av_offsets);
+        print_av_offsets("naive", av_offsets_naive);
+        if (audio_conv.BytesPerSecond() > 0)
+            printf("audio ring: %d ms lead, %" PRId64 " callbacks, %" PRId64 " underruns (%.1f ms of silence)\n",
+                   audio_lead_ms, audio_callbacks.load(), audio_underruns.load(),
+                   audio_underrun_bytes * 1000.0 / audio_conv.BytesPerSecond());
+        printf("video pictures: %" PRId64 " decoded, %" PRId64 " displayed\n", pictq_pushed.load(),
+               pictq_displayed.load());
+        if (pictq_pushed >= ALLOC_WARMUP_FRAMES)
         {
-            av_frame_free(&p->frame);
-            delete p;
+            auto allocs = video_allocs();
+            printf("video path allocations after the first %d frames: %" PRId64 " decoder buffers from the default "
+                   "allocator, %" PRId64 " AVFrames, %" PRId64 " preview buffers\n",
+                   ALLOC_WARMUP_FRAMES, allocs.buffers - warm_allocs.buffers, allocs.frames - warm_allocs.frames,
+                   allocs.preview - warm_allocs.preview);
         }
+        printf("video load: %" PRId64 " dropped before upload, ~%" PRId64 " skipped by the decoder, %" PRId64 " shown late\n",
+               frames_dropped.load(), frames_skipped.load(), frames_late.load());
+        if (quality.transitions)
+            printf("video quality: %d transitions, ended at %s\n", quality.transitions,
+                   QualityController::levels[quality.level].name);
+        if (preview.scaled_frames)
+            printf("preview: %" PRId64 " frames scaled to %dx%d after decode\n", preview.scaled_frames, preview.width,
+                   preview.height);
+        for (auto &vp : pictq)
+            av_frame_free(&vp.frame);
+        frame_arena_unref(&arena);
+    }
+
+    // flush标记也从池里取，和普通packet一样由消费者Release
+    static AVPacket *make_flush_packet()
+    {
+        auto pkt = packet_pool.Acquire();
+        pkt->opaque = flush_pkt.opaque;
+        return pkt;
     }
 
     void decode_thread()
@@ -189,6 +1166,7 @@ struct VideoState
 
         av_init_packet(&flush_pkt);
         flush_pkt.opaque = (uint8_t *)"FLUSH";
+        int64_t nb_packets = 0;
 
         while (!quit)
         {
@@ -206,23 +1184,26 @@ struct VideoState
                 else
                 {
                     audioq.Flush();
-                    audioq.Put(&flush_pkt);
+                    audioq.Put(make_flush_packet());
                     videoq.Flush();
-                    videoq.Put(&flush_pkt);
+                    videoq.Put(make_flush_packet());
                 }
                 seek_req = 0;
             }
 
-            if (audioq.size > MAX_AUDIOQ_SIZE || videoq.size > MAX_VIDEOQ_SIZE)
+            // 队列够了就等消费者取走packet时唤醒，seek和退出也会唤醒，不再SDL_Delay轮询
+            if (queues_full())
             {
-                SDL_Delay(10);
+                demux_throttle.WaitUntil([&]
+                                         { return quit || seek_req || !queues_full(); });
                 continue;
             }
 
-            auto packet = av_packet_alloc();
+            auto packet = packet_pool.Acquire();
 
             if (av_read_frame(pFormatCtx, packet) >= 0)
             {
+                nb_packets++;
                 // Is this a packet from the video stream?
                 if (packet->stream_index == videoStream)
                 {
@@ -232,20 +1213,28 @@ struct VideoState
                 {
                     audioq.Put(packet);
                 }
-
-                // Free the packet that was allocated by av_read_frame
-                av_packet_unref(packet);
+                else
+                {
+                    packet_pool.Release(packet);
+                }
             }
             else
             {
+                packet_pool.Release(packet);
                 break;
             }
-
-            av_packet_free(&packet);
         }
+
+        struct timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        auto cpu_us = cpu.tv_sec * 1000000.0 + cpu.tv_nsec / 1000.0;
+        printf("parse thread: %" PRId64 " packets, %" PRId64 " AVPacket allocations (%.4f per packet), "
+               "cpu %.3f s (%.2f us per packet)\n",
+               nb_packets, packet_pool.allocs.load(), nb_packets ? packet_pool.allocs / (double)nb_packets : 0.0,
+               cpu_us / 1000000.0, nb_packets ? cpu_us / nb_packets : 0.0);
         // 设置结束保证，防止Get无限等待
-        audioq.eof = true;
-        videoq.eof = true;
+        audioq.SetEof();
+        videoq.SetEof();
     }
 
     void decode_video_thread()
@@ -260,26 +1249,34 @@ struct VideoState
             if (packet->opaque == flush_pkt.opaque)
             {
                 avcodec_flush_buffers(video_ctx);
-                av_packet_free(&packet);
+                packet_pool.Release(packet);
                 continue;
             }
-            
+
+            // 显示循环决定的跳帧级别，只在这个线程里改解码器
+            video_ctx->skip_frame = frame_skip.Discard();
+            auto skipping = video_ctx->skip_frame != AVDISCARD_DEFAULT;
+            int frames = 0;
+            auto t0 = monotonic_us();
+            auto wait0 = pictq_wait_us;
             decode(video_ctx, packet, [&](AVFrame *frame) {     
+                frames++;
                 double pts = 0;
                 if (packet->dts != AV_NOPTS_VALUE)
                     pts = frame->best_effort_timestamp * av_q2d(video_st->time_base); // av_frame_get_best_effort_timestamp() 被移除了，使用best_effort_timestamp
 
                 pts = synchorize_video(frame, pts); // 更新视频时钟
-                frame = av_frame_clone(frame);
-                auto vp = new VideoPicture();
-                vp->frame = frame;
-                vp->pts = pts;          
-                push_video_picture(vp);
+                push_video_picture(preview.Scale(frame), pts);
             });
+            // 跳帧期间送进去的包一帧都没出才算跳过了一帧，只增不减。
+            // 帧多线程解码时包和帧不是一一对应的，计数只是估计，但不会因为一个包出了几帧变成负数
+            if (skipping && frames == 0)
+                frames_skipped++;
+            quality.Update(video_ctx, monotonic_us() - t0 - (pictq_wait_us - wait0), frames);
 
-            av_packet_free(&packet);
+            packet_pool.Release(packet);
         }
-        quit = true;
+        request_quit();
     }
 
     int decode_audio(uint8_t *audio_buf, int buf_size)
@@ -288,72 +1285,142 @@ struct VideoState
         int data_size = 0;
 
         if ((pkt = audioq.Get()) == nullptr)
-            return -1;  // 声音不能block，否则SDL的音频会停止工作
+            return -1;  // 在音频解码线程里，可以block
 
         if (pkt->opaque == flush_pkt.opaque)
         {
             avcodec_flush_buffers(audio_ctx);
-            av_packet_free(&pkt);
+            pcm_ring.Discard(); // seek之前缓冲的PCM不再播放
+            packet_pool.Release(pkt);
             return 0;
         }
         
         decode(audio_ctx, pkt, [&](AVFrame *frame)
                {
-                auto sample_size = av_get_bytes_per_sample(audio_ctx->sample_fmt);
-                if (sample_size < 0)
+                auto size = audio_conv.Convert(frame, audio_buf + data_size, buf_size - data_size);
+                if (size < 0)
                 {
-                    /* This should not occur, checking just for paranoia */
-                    fprintf(stderr, "Failed to calculate data size\n");
+                    fprintf(stderr, "Failed to convert audio frame\n");
                     return;
                 }
-                for (auto i = 0; i < frame->nb_samples; i++)
-                {
-                    for (auto ch = 0; ch < audio_ctx->ch_layout.nb_channels; ch++)
-                    {
-                        memcpy(audio_buf + data_size, frame->data[ch] + sample_size * i, sample_size);
-                        data_size += sample_size;
-                    }
-                } 
-                // 音频就直接使用pts
-                if(pkt->pts != AV_NOPTS_VALUE) {
-                    audio_clock = av_q2d(audio_st->time_base)*pkt->pts;
-                }});
-        av_packet_free(&pkt);
+                data_size += size;
+                // 帧没有pts就接着上一帧算
+                if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+                    audio_next_pts = frame->best_effort_timestamp * av_q2d(audio_st->time_base);
+                audio_next_pts += (double)frame->nb_samples / frame->sample_rate;
+                // 重采样器里压着的样本还没输出，要减掉
+                audio_clock = audio_next_pts - audio_conv.DelaySeconds(); });
+        packet_pool.Release(pkt);
 
         return data_size;
     }
 
-    int push_video_picture(VideoPicture *pict)
+    // 解码、转换都在这个线程里做，pcm_ring里不足audio_lead_bytes就继续解码，够了就等回调读走
+    void audio_decode_thread()
+    {
+        bool started = false;
+
+        while (!quit)
+        {
+            auto seen = pcm_ring.reads.load(std::memory_order_acquire);
+            if (pcm_ring.Available() >= audio_lead_bytes)
+            {
+                // 第一次缓冲够了才开始播放，避免一开始就欠载
+                if (!started)
+                {
+                    started = true;
+                    SDL_PauseAudio(0);
+                }
+                pcm_ring.WaitRead(seen);
+                continue;
+            }
+
+            auto size = decode_audio(audio_buf, sizeof(audio_buf));
+            if (size < 0)
+                break;
+            // 这段数据写完后，pcm_ring的末尾对应audio_clock
+            if (size > 0)
+                audio_anchor.Store(pcm_ring.tail.load(std::memory_order_relaxed) + size, audio_clock);
+            for (size_t done = 0; done < (size_t)size && !quit;)
+            {
+                seen = pcm_ring.reads.load(std::memory_order_acquire);
+                done += pcm_ring.Write(audio_buf + done, size - done);
+                if (done < (size_t)size)
+                    pcm_ring.WaitRead(seen);
+            }
+        }
+        audio_eof = true;
+        if (!started)
+            SDL_PauseAudio(0);
+    }
+
+    VideoAllocs video_allocs()
+    {
+        return {arena ? frame_arena_fallbacks(arena) : default_buffers.load(), decode_frame_allocs.load(),
+                PreviewScaler::buffer_allocs.load()};
+    }
+
+    // 没开arena时视频解码器也用这个get_buffer2，只为了数默认分配器给出去的缓冲
+    static int counting_get_buffer2(AVCodecContext *s, AVFrame *frame, int flags)
+    {
+        static_cast<VideoState *>(s->opaque)->default_buffers++;
+        return avcodec_default_get_buffer2(s, frame, flags);
+    }
+
+    // 把frame的引用移进空闲槽位，frame本身变成空帧。不clone，不分配
+    int push_video_picture(AVFrame *frame, double pts)
     {
         std::unique_lock lk(pictq_mutex);
+        auto t0 = monotonic_us();
         pictq_cond.wait(lk, [&]
                 { return quit || pictq_size < VIDEO_PICTURE_QUEUE_SIZE; });
+        pictq_wait_us += monotonic_us() - t0;
 
         if (quit)
             return -1;
         // TODO: B帧排序
-        pictq[pictq_windex] = pict;
+        auto &vp = pictq[pictq_windex];
+        av_frame_move_ref(vp.frame, frame);
+        vp.pts = pts;
         pictq_windex = (pictq_windex + 1) % VIDEO_PICTURE_QUEUE_SIZE;
         ++pictq_size;
+        if (++pictq_pushed == ALLOC_WARMUP_FRAMES)
+            warm_allocs = video_allocs();
 
         lk.unlock();
         pictq_cond.notify_one();
         return 0;
     }
 
-    int pop_video_picture(VideoPicture *&pict)
+    // 取队头的槽位，显示完之前槽位仍然被占着，显示完调用release_video_picture归还
+    // 显示循环：最多等timeout_us，队列里有画面就返回，超时或退出返回nullptr。starved表示来取的时候队列已经空了
+    VideoPicture *wait_video_picture(bool &starved, int64_t timeout_us)
     {
         std::unique_lock lk(pictq_mutex);
-        if (quit || pictq_size == 0)
-            return -1;
+        starved = pictq_size == 0;
+        if (!pictq_cond.wait_for(lk, std::chrono::microseconds(timeout_us), [&]
+                { return quit || pictq_size > 0; }) || quit)
+            return nullptr;
+        return &pictq[pictq_rindex];
+    }
+
+    // 当前这一帧后面是否还有帧，丢帧前要确认，不能把最后一帧也丢了
+    bool has_next_picture()
+    {
+        std::unique_lock lk(pictq_mutex);
+        return pictq_size > 1;
+    }
 
-        pict = pictq[pictq_rindex];
-        pictq[pictq_rindex] = nullptr;
+    void release_video_picture(bool displayed = true)
+    {
+        std::unique_lock lk(pictq_mutex);
+        av_frame_unref(pictq[pictq_rindex].frame);
         pictq_rindex = (pictq_rindex + 1) % VIDEO_PICTURE_QUEUE_SIZE;
         --pictq_size;
+        if (displayed)
+            pictq_displayed++;
         lk.unlock();
         pictq_cond.notify_one();
-        return 0;
     }
 
     int stream_componet_open(int stream_index)
@@ -374,28 +1441,42 @@ struct VideoState
             fprintf(stderr, "Couldn't copy codec context");
             return -1; // Error copying codec context
         }
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            decoder_threads_apply(codecCtx, &video_threads);
+            preview.Setup(codecCtx, codec);
+        }
+        // 解码器支持直接渲染到用户给的缓冲(DR1)时，画面从arena分配
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO && arena_frames > 0 && (codec->capabilities & AV_CODEC_CAP_DR1))
+        {
+            arena = frame_arena_create(arena_frames, arena_hugepages);
+            codecCtx->opaque = arena;
+            codecCtx->get_buffer2 = frame_arena_get_buffer2;
+        }
+        else if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+        {
+            codecCtx->opaque = this;
+            codecCtx->get_buffer2 = counting_get_buffer2;
+        }
         // 打开解码器
         if (avcodec_open2(codecCtx, codec, NULL) < 0)
             return -1;
+        if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+            fprintf(stderr, "video decoder threads: %d, type %s\n", codecCtx->thread_count,
+                    codecCtx->active_thread_type == FF_THREAD_FRAME   ? "frame"
+                    : codecCtx->active_thread_type == FF_THREAD_SLICE ? "slice"
+                                                                      : "none");
 
         switch (codecCtx->codec_type)
         {
         case AVMEDIA_TYPE_AUDIO:
         {
             // Set audio settings from codec info
+            // 设备不一定能给出请求的参数，以SDL返回的spec为准，由audio_conv转换过去
             SDL_AudioSpec wanted_spec, spec;
             wanted_spec.freq = codecCtx->sample_rate;
-            if (codecPar->format == AV_SAMPLE_FMT_FLTP)
-                wanted_spec.format = AUDIO_F32SYS;
-            else if (codecPar->format == AV_SAMPLE_FMT_S16P)
-                wanted_spec.format = AUDIO_S16SYS;
-            else
-            {
-                fprintf(stderr, "Unsupport format %d", codecPar->format);
-                return -1;
-            }
-
-            wanted_spec.channels = codecCtx->ch_layout.nb_channels;
+            wanted_spec.format = AudioConverter::ToSDL(codecCtx->sample_fmt);
+            wanted_spec.channels = std::min(codecCtx->ch_layout.nb_channels, 8);
             wanted_spec.silence = 0;
             wanted_spec.samples = SDL_AUDIO_BUFFER_SIZE;
             wanted_spec.callback = audio_callback;
@@ -406,12 +1487,26 @@ struct VideoState
                 fprintf(stderr, "SDL_OpenAudio: %s\n", SDL_GetError());
                 return -1;
             }
+            if (audio_conv.Open(spec) < 0)
+            {
+                SDL_CloseAudio();
+                return -1;
+            }
+            audio_silence = spec.silence;
+            audio_hw_buf_size = spec.size;
+            audio_period = (double)spec.samples / spec.freq;
+            audio_lead_bytes = (size_t)audio_lead_ms * audio_conv.BytesPerSecond() / 1000;
+            // 留出一次回调和一次解码输出的余量，生产者写满lead之后不用马上等
+            pcm_ring.Init(audio_lead_bytes + 2 * spec.size + sizeof(audio_buf) / 4);
 
             audioStream = stream_index;
             audio_st = pFormatCtx->streams[stream_index];
             audio_ctx = codecCtx;
+            audioq.time_base = audio_st->time_base;
+            if (codecCtx->frame_size > 0)
+                audioq.default_duration = av_rescale_q(codecCtx->frame_size, {1, codecCtx->sample_rate}, audio_st->time_base);
 
-            SDL_PauseAudio(0);
+            audio_thread = std::thread(&VideoState::audio_decode_thread, this);
             break;
         }
         case AVMEDIA_TYPE_VIDEO:
@@ -419,7 +1514,13 @@ struct VideoState
             videoStream = stream_index;
             video_st = pFormatCtx->streams[stream_index];
             video_ctx = codecCtx;
-            frame_timer = av_gettime() / 1000000.0; // Get the current time in seconds.
+            videoq.time_base = video_st->time_base;
+            auto frame_rate = av_guess_frame_rate(pFormatCtx, video_st, NULL);
+            if (frame_rate.num > 0 && frame_rate.den > 0)
+                quality.frame_interval = av_q2d(av_inv_q(frame_rate));
+            if (video_st->avg_frame_rate.num > 0 && video_st->avg_frame_rate.den > 0)
+                videoq.default_duration = av_rescale_q(1, av_inv_q(video_st->avg_frame_rate), video_st->time_base);
+            frame_timer = monotonic_us() / 1000000.0; // 和显示循环的截止时间用同一个单调时钟
             frame_last_delay = 40e-3;
 
             video_thread = std::thread(&VideoState::decode_video_thread, this);
@@ -444,16 +1545,37 @@ struct VideoState
         return pts;
     }
 
+    // 回调时刻的播放位置按真实时间外推。回调停了(暂停、设备卡住)时最多外推两个回调间隔，不会一直往前走
     double get_audio_clock()
+    {
+        int64_t time;
+        double pts;
+        audio_clock_sample.Load(time, pts);
+        if (time == 0)
+            return 0.0;
+        auto elapsed = (av_gettime_relative() - time) / 1000000.0;
+        pts += std::min(elapsed, 2 * audio_period);
+        return pts < 0.0 ? 0.0 : pts;
+    }
+
+    // 原来的算法：只减去还没交给SDL的数据，不管设备里排着的，也不外推。留给--av-offset做对比
+    double get_audio_clock_naive()
     {
         double pts = audio_clock;
-        // 处理还没投喂给SDL的缓存数据长度
-        double hw_buf_size = audio_buf_size - audio_buf_index;
-        double bytes_per_sec = audio_st->codecpar->sample_rate * audio_st->codecpar->channels * 2;
-        pts -= hw_buf_size / bytes_per_sec;
-        if (pts < 0.0)
-            pts = 0.0;
-        return pts;
+        pts -= pcm_ring.Available() / (double)audio_conv.BytesPerSecond();
+        return pts < 0.0 ? 0.0 : pts;
+    }
+
+    // 通知所有线程退出，把等待中的都叫醒
+    void request_quit()
+    {
+        quit = true;
+        demux_throttle.Wake();
+        audioq.SetEof(); // 解包线程可能正卡在满了的队列的Put里
+        videoq.SetEof();
+        pcm_ring.Wake();
+        std::lock_guard lk(pictq_mutex);
+        pictq_cond.notify_all();
     }
 
     void stream_seek(int64_t pos, int rel)
@@ -463,139 +1585,489 @@ struct VideoState
             seek_pos = pos;
             seek_flags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
             seek_req = 1;
+            demux_throttle.Wake();
         }
     }
-};
 
-static int decode(AVCodecContext *dec_ctx, AVPacket *pkt, std::function<void(AVFrame *)> onFrame)
-{
-    int ret = AVERROR(1);
-
-    /* send the packet with the compressed data to the decoder */
-    ret = avcodec_send_packet(dec_ctx, pkt);
-    if (ret < 0)
+    // 两路都缓冲了queue_seconds秒才算满，只有一路满时继续读，避免另一路饿死；
+    // 任何一路超过字节上限或者环形队列的槽位快用完了，则无条件停下，不让Put阻塞在一路上
+    bool queues_full()
     {
-        fprintf(stderr, "Error submitting the packet to the decoder\n");
-        return ret;
+        if (audioq.size > MAX_AUDIOQ_SIZE || videoq.size > MAX_VIDEOQ_SIZE)
+            return true;
+        if (audioq.NearlyFull() || videoq.NearlyFull())
+            return true;
+        return audioq.Seconds() >= queue_seconds && videoq.Seconds() >= queue_seconds;
     }
+};
 
-    /* read all the output frames (in general there may be any number of them */
-    while (ret >= 0)
-    {
-        auto frame = av_frame_alloc();
-        ret = avcodec_receive_frame(dec_ctx, frame);
-        if (ret < 0)
-        {
-            break;
-        }
-        onFrame(frame);
-        av_frame_free(&frame);
-    }
-    return ret == AVERROR(EAGAIN) ? 0 : ret;
-}
 
 
 
+// SDL的实时音频线程：只从pcm_ring拷贝，不解码不加锁。数据不够时补静音并计为一次欠载(播完之后的不算)
 void audio_callback(void *userdata, Uint8 *stream, int len)
 {
     VideoState *is = (VideoState *)userdata;
-    int len1, audio_size;
-
+    auto now = av_gettime_relative();
+    auto n = is->pcm_ring.Read(stream, len);
+
+    // 读完之后head处数据的pts，再往前退掉刚交出去的n字节和设备里排着的一个缓冲，就是此刻正在播放的位置
+    int64_t anchor_pos;
+    double anchor_pts;
+    is->audio_anchor.Load(anchor_pos, anchor_pts);
+    if (anchor_pos > 0)
+    {
+        double bytes_per_sec = is->audio_conv.BytesPerSecond();
+        auto head = (int64_t)is->pcm_ring.head.load(std::memory_order_relaxed);
+        auto pts = anchor_pts - (anchor_pos - head) / bytes_per_sec - (n + is->audio_hw_buf_size) / bytes_per_sec;
+        is->audio_clock_sample.Store(now, pts);
+    }
 
-    while (len > 0)
+    is->audio_callbacks.fetch_add(1, std::memory_order_relaxed);
+    if (n < (size_t)len)
     {
-        if (is->audio_buf_index >= is->audio_buf_size)
+        memset(stream + n, is->audio_silence, len - n);
+        if (!is->audio_eof.load(std::memory_order_relaxed))
         {
-            /* We have already sent all our data; get more */
-            audio_size = is->decode_audio(is->audio_buf, sizeof(is->audio_buf));
-            if (audio_size < 0)
-            {
-                /* If error, output silence */
-                is->audio_buf_size = 1024; // arbitrary?
-                memset(is->audio_buf, 0, is->audio_buf_size);
-            }
-            else
-            {
-                is->audio_buf_size = audio_size;
-            }
-            is->audio_buf_index = 0;
+            is->audio_underruns.fetch_add(1, std::memory_order_relaxed);
+            is->audio_underrun_bytes.fetch_add(len - n, std::memory_order_relaxed);
         }
-        len1 = is->audio_buf_size - is->audio_buf_index;
-        if (len1 > len)
-            len1 = len;
-        memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
-        len -= len1;
-        stream += len1;
-        is->audio_buf_index += len1;
     }
 }
 
 
 
-static uint32_t sdl_refresh_timer_cb(uint32_t interval, void *opaque)
+// clock_nanosleep绝对时间睡到wake(monotonic_us)
+static void sleep_to_us(int64_t wake)
 {
-    SDL_Event event;
-    event.type = FF_REFRESH_EVENT;
-    event.user.data1 = opaque;
-    SDL_PushEvent(&event);
-    return 0; /* 0 means stop timer */
+    if (wake > monotonic_us())
+    {
+#ifdef __APPLE__
+        // macOS没有clock_nanosleep
+        std::this_thread::sleep_for(std::chrono::microseconds(wake - monotonic_us()));
+#else
+        struct timespec ts = {(time_t)(wake / 1000000), (long)(wake % 1000000 * 1000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+#endif
+    }
 }
 
-void schedule_refresh(VideoState *is, int delay)
+// 睡到deadline(monotonic_us)：睡到差PRESENT_SPIN_US的时候，剩下的忙等，避开定时器粒度和线程唤醒的延迟
+static void sleep_until_us(int64_t deadline)
 {
-    SDL_AddTimer(delay, sdl_refresh_timer_cb, is);
+    sleep_to_us(deadline - PRESENT_SPIN_US);
+    while (monotonic_us() < deadline)
+        ;
 }
 
-void video_refresh_timer(VideoState *is, std::function<void(AVFrame *)> onDisplay)
+// 实际时间减计划时间(微秒)的直方图
+struct PresentHistogram
 {
-    if (!is)
+    static constexpr int64_t bounds[] = {50, 100, 250, 500, 1000, 2000, 5000, 10000, 20000};
+    static constexpr int nb_buckets = sizeof(bounds) / sizeof(bounds[0]) + 1;
+    int64_t counts[nb_buckets] = {};
+    int64_t n = 0, sum = 0, max = 0;
+
+    void Add(int64_t late)
     {
-        schedule_refresh(is, 100);
-        return;
+        auto i = 0;
+        while (i < nb_buckets - 1 && late >= bounds[i])
+            i++;
+        counts[i]++;
+        n++;
+        sum += late;
+        max = std::max(max, late);
     }
-    VideoPicture *vp = nullptr;
-    if (is->pop_video_picture(vp) < 0)
+
+    void Print(const char *name) const
     {
-        schedule_refresh(is, 1);
-        return;
+        if (n == 0)
+            return;
+        printf("%s - scheduled: %" PRId64 " frames, mean %.0f us, max %" PRId64 " us\n", name, n, (double)sum / n, max);
+        for (auto i = 0; i < nb_buckets; i++)
+        {
+            if (!counts[i])
+                continue;
+            if (i < nb_buckets - 1)
+                printf("  < %6" PRId64 " us %6.2f%%\n", bounds[i], 100.0 * counts[i] / n);
+            else
+                printf("  >=%6" PRId64 " us %6.2f%%\n", bounds[i - 1], 100.0 * counts[i] / n);
+        }
     }
+};
 
-    auto delay = vp->pts - is->frame_last_pts;
-    if (delay <= 0 || delay >= 1)
-        delay = is->frame_last_delay;
+// 处理窗口事件：退出、左右键seek、空格暂停。SDL_PumpEvents只能在创建窗口的线程里调用
+static void handle_events(VideoState *is)
+{
+    SDL_Event e;
+    SDL_PumpEvents();
+    while (SDL_PeepEvents(&e, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
+    {
+        if (e.type == SDL_QUIT)
+        {
+            is->request_quit();
+            return;
+        }
+        if (e.type == SDL_KEYDOWN)
+        {
+            double incr, pos;
+            switch (e.key.keysym.sym)
+            {
+                case SDLK_LEFT:
+                {
+                    incr = -10.0;
+                    goto do_seek;
+                }
+                case SDLK_RIGHT:
+                {
+                    incr = 10.0;
+                    goto do_seek;
+                }
+            do_seek:
+                pos = is->get_audio_clock();
+                pos += incr;
+                is->stream_seek((int64_t)(pos * AV_TIME_BASE), incr);
+                break;
+                case SDLK_SPACE:
+                {
+                    if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED)
+                        SDL_PauseAudio(0);
+                    else
+                        SDL_PauseAudio(1);
+                    break;
+                }
+            }
+        }
+    }
+}
 
-    is->frame_last_delay = delay;
-    is->frame_last_pts = vp->pts;
+// 显示循环，跑在创建窗口的主线程里(SDL的渲染API不是线程安全的，macOS上只能在主线程用)：
+// 取一帧，按音视频同步算出它的截止时间，睡到截止时间再上传纹理、present。不再经过SDL_AddTimer和事件队列。
+// 等画面和等截止时间都按EVENT_POLL_US分段，间隙里处理事件
+static void present_loop(VideoState *is, SDL_Window *window)
+{
+    // 创建SDL渲染器
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
+    if (!renderer)
+    {
+        fprintf(stderr, "无法创建渲染器 - %s\n", SDL_GetError());
+        is->request_quit();
+        return;
+    }
 
-    auto ref_clock = is->get_audio_clock();
-    auto diff = vp->pts - ref_clock;
+    // 纹理按画面尺寸在第一帧到来时创建，分辨率变化时重建；预览模式下画面已经按窗口缩小过
+    VideoTexture texture;
+    video_texture_init(&texture, renderer);
+    texture.lock = is->upload_lock;
 
-    // ffplay的策略：如果同步的差值在 [0.01, 10] 范围内，如果小于 -0.01，直接延迟0秒加速播； 如果大于 0.01，delay加倍，放慢视频播放 
-    auto sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
-    if (fabs(diff) < AV_NOSYNC_THRESHOLD) 
+    // wake：睡醒的时刻；present：SDL_RenderPresent返回的时刻
+    PresentHistogram wake_hist, present_hist;
+    bool starved = false;
+    while (!is->quit)
     {
-        if (diff <= -sync_threshold)
-            delay = 0;
-        else if (diff >= sync_threshold)
-            delay = 2 * delay;
+        handle_events(is);
+        bool empty;
+        auto vp = is->wait_video_picture(empty, EVENT_POLL_US);
+        starved = starved || empty;
+        if (!vp)
+            continue;
+        auto was_starved = starved;
+        starved = false;
+
+        auto delay = vp->pts - is->frame_last_pts;
+        if (delay <= 0 || delay >= 1)
+            delay = is->frame_last_delay;
+
+        is->frame_last_delay = delay;
+        is->frame_last_pts = vp->pts;
+
+        auto ref_clock = is->get_audio_clock();
+        auto diff = vp->pts - ref_clock;
+
+        // ffplay的策略：如果同步的差值在 [0.01, 10] 范围内，如果小于 -0.01，直接延迟0秒加速播； 如果大于 0.01，delay加倍，放慢视频播放 
+        auto sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
+        if (fabs(diff) < AV_NOSYNC_THRESHOLD) 
+        {
+            // 已经落后音频超过一帧，而且后面还有帧：直接丢掉，省下纹理上传和present
+            if (is->frame_skip.enabled && diff < -delay && is->has_next_picture())
+            {
+                is->frames_dropped++;
+                is->frame_skip.Update(true);
+                is->release_video_picture(false);
+                continue;
+            }
+            if (diff <= -sync_threshold)
+                delay = 0;
+            else if (diff >= sync_threshold)
+                delay = 2 * delay;
+        }
+        auto late = fabs(diff) < AV_NOSYNC_THRESHOLD && diff <= -sync_threshold;
+
+        is->frame_timer += delay;
+        auto now = monotonic_us() / 1000000.0;
+        if (now - is->frame_timer > FRAME_TIMER_RESET)
+            is->frame_timer = now;
+        auto deadline = (int64_t)(is->frame_timer * 1000000);
+
+        // 离截止时间还远就分段睡，每段之间处理事件；最后一段睡加忙等，中间不再处理事件
+        auto wake = deadline - PRESENT_SPIN_US - EVENT_POLL_US;
+        while (!is->quit && monotonic_us() < wake)
+        {
+            sleep_to_us(std::min(wake, monotonic_us() + EVENT_POLL_US));
+            handle_events(is);
+        }
+        if (is->quit)
+            break;
+        sleep_until_us(deadline);
+        wake_hist.Add(monotonic_us() - deadline);
+
+        // 将YUV数据填充到SDL纹理中
+        if (video_texture_upload(&texture, vp->frame) < 0 && !texture.texture)
+        {
+            is->request_quit();
+            break;
+        }
+        // 清空渲染器
+        SDL_RenderClear(renderer);
+        // 将纹理复制到渲染器
+        SDL_RenderCopy(renderer, texture.texture, NULL, NULL);
+        // 刷新屏幕
+        SDL_RenderPresent(renderer);
+        present_hist.Add(monotonic_us() - deadline);
+        if (late)
+            is->frames_late++;
+        is->frame_skip.Update(was_starved || late);
+
+        // 画面刚刚present，和这一刻的音频位置比较
+        if (is->measure_av_offset)
+        {
+            is->av_offsets.push_back(vp->pts - is->get_audio_clock());
+            is->av_offsets_naive.push_back(vp->pts - is->get_audio_clock_naive());
+        }
+
+        is->release_video_picture();
     }
 
-    is->frame_timer += delay;
-    auto actual_dealy = is->frame_timer - (av_gettime() / 1000000.0); // 跟实际时钟求时间差，应该是为了消除误差
-    if (actual_dealy < 0.010) 
-        actual_dealy = 0.010;
+    wake_hist.Print("wake");
+    present_hist.Print("present");
+    video_texture_print_stats(&texture);
+    video_texture_destroy(&texture);
+    SDL_DestroyRenderer(renderer);
+}
+
+// 一个线程Put，一个线程阻塞Get，比较两种队列的吞吐和延迟。packet的pts里记录入队时间
+template <typename Queue>
+static void bench_packet_queue(const char *name, int count)
+{
+    auto queue = std::make_unique<Queue>();
+    std::vector<int64_t> latency(count);
+    // packet在计时之前一次分配好，不经过packet_pool，测出来的只有队列本身的开销
+    std::vector<AVPacket> packets(count);
+
+    auto t0 = av_gettime_relative();
+    std::thread producer([&]
+                         {
+        for (auto i = 0; i < count; i++)
+        {
+            auto pkt = &packets[i];
+            pkt->size = 1024;
+            pkt->pts = av_gettime_relative();
+            queue->Put(pkt);
+        }
+        queue->SetEof(); });
+
+    auto n = 0;
+    while (auto p = queue->Get())
+    {
+        latency[n++] = av_gettime_relative() - p->pts;
+    }
+    producer.join();
+    auto elapsed = av_gettime_relative() - t0;
+
+    std::sort(latency.begin(), latency.begin() + n);
+    double sum = 0;
+    for (auto i = 0; i < n; i++)
+        sum += latency[i];
+    printf("%-16s %6.2f M packets/s, latency avg %.1f us, p50 %" PRId64 " us, p99 %" PRId64 " us, max %" PRId64 " us\n",
+           name, n / (double)elapsed, n ? sum / n : 0.0, n ? latency[n / 2] : 0, n ? latency[n * 99 / 100] : 0,
+           n ? latency[n - 1] : 0);
+}
 
-    schedule_refresh(is, (int)(actual_dealy * 1000.0 + 0.5));
+// 按AAC一帧1024个样本，比较逐样本memcpy和audio_interleave，顺便校验两者输出一致
+static void bench_interleave(int iterations)
+{
+    const int nb_samples = 1024;
+    const struct
+    {
+        const char *name;
+        int sample_size;
+    } formats[] = {{"fltp", 4}, {"s16p", 2}};
+    const int channels[] = {1, 2, 6, 8};
 
-    onDisplay(vp->frame);
+    for (auto &fmt : formats)
+    {
+        for (auto nb_channels : channels)
+        {
+            std::vector<std::vector<uint8_t>> planes(nb_channels, std::vector<uint8_t>(nb_samples * fmt.sample_size));
+            std::vector<const uint8_t *> src;
+            for (auto &plane : planes)
+            {
+                for (auto &b : plane)
+                    b = rand();
+                src.push_back(plane.data());
+            }
+            std::vector<uint8_t> ref(nb_samples * nb_channels * fmt.sample_size), out(ref.size());
+
+            auto t0 = av_gettime_relative();
+            for (auto i = 0; i < iterations; i++)
+                audio_interleave_memcpy(ref.data(), src.data(), fmt.sample_size, nb_channels, nb_samples);
+            auto t1 = av_gettime_relative();
+            for (auto i = 0; i < iterations; i++)
+                audio_interleave(out.data(), src.data(), fmt.sample_size, nb_channels, nb_samples);
+            auto t2 = av_gettime_relative();
+
+            // 每秒处理的样本数(每个声道算一个)
+            auto rate = [&](int64_t us)
+            { return (double)iterations * nb_samples * nb_channels / std::max<int64_t>(us, 1); };
+            printf("%s %dch: memcpy %7.1f M samples/s, interleave %7.1f M samples/s, %5.1fx%s\n", fmt.name,
+                   nb_channels, rate(t1 - t0), rate(t2 - t1), (double)(t1 - t0) / std::max<int64_t>(t2 - t1, 1),
+                   ref == out ? "" : "  MISMATCH");
+        }
+    }
+}
 
-    av_frame_unref(vp->frame);
-    delete vp;
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] <movie file>\n"
+                    "  -j, --decoder-threads N  video decoder thread count\n"
+                    "      --thread-type TYPE   frame, slice, both, or tune\n"
+                    "      --arena FRAMES       allocate decoded pictures from a preallocated arena\n"
+                    "      --hugepages          back the arena with huge pages when possible\n"
+                    "      --queue-seconds S    buffer S seconds of packets per stream (default 2)\n"
+                    "      --audio-lead MS      keep MS milliseconds of decoded audio ahead of the device (default 100)\n"
+                    "      --av-offset          record the A/V offset of every displayed frame and print its distribution\n"
+                    "      --no-frame-drop      show every frame even when behind, and never let the decoder skip frames\n"
+                    "      --no-adaptive-quality  never switch the video decoder to cheaper settings when it is too slow\n"
+                    "      --window WxH         window size (default 720x560)\n"
+                    "      --preview            decode at reduced resolution (lowres or early downscale) to fit the window\n"
+                    "      --upload MODE        texture upload: update (SDL_UpdateYUVTexture, default) or lock (SDL_LockTexture)\n"
+                    "      --bench-queue        compare the locked and lock-free packet queues, then exit\n"
+                    "      --bench-interleave   compare the audio interleave kernels with per-sample memcpy, then exit\n"
+                    "      --bench-upload       measure texture upload ms/frame at 1080p and 4K, then exit\n"
+                    "      --bench-formats      measure per-format conversion throughput against sws_scale, then exit\n",
+            prog);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    static const struct option long_options[] = {
+        {"decoder-threads", required_argument, NULL, 'j'},
+        {"thread-type", required_argument, NULL, 'T'},
+        {"arena", required_argument, NULL, 'a'},
+        {"hugepages", no_argument, NULL, 'H'},
+        {"bench-queue", no_argument, NULL, 'Q'},
+        {"bench-interleave", no_argument, NULL, 'I'},
+        {"queue-seconds", required_argument, NULL, 'q'},
+        {"audio-lead", required_argument, NULL, 'l'},
+        {"av-offset", no_argument, NULL, 'O'},
+        {"no-frame-drop", no_argument, NULL, 'D'},
+        {"no-adaptive-quality", no_argument, NULL, 'R'},
+        {"window", required_argument, NULL, 'W'},
+        {"preview", no_argument, NULL, 'P'},
+        {"upload", required_argument, NULL, 'U'},
+        {"bench-upload", no_argument, NULL, 'B'},
+        {"bench-formats", no_argument, NULL, 'F'},
+        {NULL, 0, NULL, 0},
+    };
+    DecoderThreads video_threads{};
+    int arena_frames = 0;
+    bool arena_hugepages = false;
+    double queue_seconds = MAX_QUEUE_SECONDS;
+    int audio_lead_ms = AUDIO_LEAD_MS;
+    bool measure_av_offset = false;
+    bool frame_drop = true;
+    bool adaptive_quality = true;
+    int window_w = 720, window_h = 560;
+    bool preview = false;
+    bool upload_lock = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "j:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            video_threads.count = atoi(optarg);
+            video_threads.count_set = 1;
+            break;
+        case 'a':
+            arena_frames = atoi(optarg);
+            break;
+        case 'H':
+            arena_hugepages = true;
+            break;
+        case 'q':
+            queue_seconds = atof(optarg);
+            break;
+        case 'l':
+            audio_lead_ms = atoi(optarg);
+            if (audio_lead_ms <= 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'O':
+            measure_av_offset = true;
+            break;
+        case 'D':
+            frame_drop = false;
+            break;
+        case 'R':
+            adaptive_quality = false;
+            break;
+        case 'W':
+            if (sscanf(optarg, "%dx%d", &window_w, &window_h) != 2 || window_w <= 0 || window_h <= 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'P':
+            preview = true;
+            break;
+        case 'U':
+            if (strcmp(optarg, "lock") != 0 && strcmp(optarg, "update") != 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            upload_lock = strcmp(optarg, "lock") == 0;
+            break;
+        case 'B':
+            video_texture_bench(400);
+            return 0;
+        case 'F':
+            video_texture_bench_convert(200);
+            return 0;
+        case 'Q':
+            bench_packet_queue<PacketQueue>("list + mutex", 200000);
+            bench_packet_queue<RingPacketQueue>("spsc ring", 200000);
+            return 0;
+        case 'I':
+            bench_interleave(20000);
+            return 0;
+        case 'T':
+            if (decoder_threads_parse_type(&video_threads, optarg) == 0)
+                break;
+            // fallthrough
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc)
     {
         printf("Please provide a movie file\n");
         return -1;
@@ -609,99 +2081,34 @@ int main(int argc, char *argv[])
     }
 
     // 创建SDL窗口
-    SDL_Window *window = SDL_CreateWindow("Windows", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 720, 560, SDL_WINDOW_SHOWN);
+    SDL_Window *window = SDL_CreateWindow("Windows", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, window_w, window_h, SDL_WINDOW_SHOWN);
     if (!window)
     {
         fprintf(stderr, "无法创建窗口 - %s\n", SDL_GetError());
         return -1;
     }
 
-    // 创建SDL渲染器
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
-    if (!renderer)
-    {
-        fprintf(stderr, "无法创建渲染器 - %s\n", SDL_GetError());
-        return -1;
-    }
-
-    // 创建SDL纹理
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, 720, 560);
-    if (!texture)
-    {
-        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
-        return -1;
-    }
-
     auto is = std::make_shared<VideoState>();
-    is->Open(argv[1]);
-
-    schedule_refresh(is.get(), 40);
-
-
-    SDL_Event e;
-    while (!is->quit)
-    {
-        while (SDL_PollEvent(&e) != 0)
-        {
-            if (e.type == SDL_QUIT)
-            {
-                is->quit = true;
-                break;
-            }
-            if (e.type == SDL_KEYDOWN)
-            {
-                double incr, pos;
-                switch (e.key.keysym.sym)
-                {
-                    case SDLK_LEFT:
-                    {
-                        incr = -10.0;
-                        goto do_seek;
-                    }
-                    case SDLK_RIGHT:
-                    {
-                        incr = 10.0;
-                        goto do_seek;
-                    }
-                do_seek:
-                    pos = is->get_audio_clock();
-                    pos += incr;
-                    is->stream_seek((int64_t)(pos * AV_TIME_BASE), incr);
-                    break;
-                    case SDLK_SPACE:
-                    {
-                        if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED)
-                            SDL_PauseAudio(0);
-                        else
-                            SDL_PauseAudio(1);
-                        break;
-                    }
-                }
-            }
-            if (e.type == FF_REFRESH_EVENT)
-            {
-
-                video_refresh_timer(is.get(), [&](AVFrame *frame)
-                                    {
-                                    // 将YUV数据填充到SDL纹理中
-                    SDL_UpdateYUVTexture(texture, NULL,
-                                        frame->data[0], frame->linesize[0],
-                                        frame->data[1], frame->linesize[1],
-                                        frame->data[2], frame->linesize[2]);
-                    // 清空渲染器
-                    SDL_RenderClear(renderer);
-                    // 将纹理复制到渲染器
-                    SDL_RenderCopy(renderer, texture, NULL, NULL);
-                    // 刷新屏幕
-                    SDL_RenderPresent(renderer);
-                });
-            }
-        }
-    }
-
-    // 销毁SDL纹理、渲染器和窗口
-    SDL_DestroyTexture(texture);
-    SDL_DestroyRenderer(renderer);
+    is->video_threads = video_threads;
+    is->arena_frames = arena_frames;
+    is->arena_hugepages = arena_hugepages;
+    is->queue_seconds = queue_seconds;
+    is->audio_lead_ms = audio_lead_ms;
+    is->measure_av_offset = measure_av_offset;
+    is->frame_skip.enabled = frame_drop;
+    is->quality.enabled = adaptive_quality;
+    is->preview.enabled = preview;
+    is->upload_lock = upload_lock;
+    SDL_GetWindowSize(window, &is->preview.max_width, &is->preview.max_height);
+    is->Open(argv[optind]);
+
+    // 画面在主线程里按时间表present，等待的间隙处理事件
+    present_loop(is.get(), window);
+    is->request_quit();
+    // 线程、音频设备和统计都在VideoState析构里处理，必须在SDL_Quit之前
+    is.reset();
+
+    // 销毁SDL窗口
     SDL_DestroyWindow(window);
 
     // 退出SDL
@@ -0,0 +1,382 @@
+// video_texture.c
+// 按画面尺寸和格式创建纹理并上传，说明见video_texture.h
+
+#include "video_texture.h"
+#include "plane_convert.h"
+
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    PATH_DIRECT,       // SDL直接支持，update/lock都可以
+    PATH_CHROMA_ROWS,  // 422：色度隔行取成420，update时把色度linesize乘2就行，不用拷
+    PATH_CHROMA_HALVE, // 444：色度隔行、隔列取
+    PATH_NARROW,       // 10位收窄成8位
+    PATH_SWS,          // 其他格式整帧sws_scale成yuv420p
+};
+
+typedef struct FormatPath
+{
+    int format; // enum AVPixelFormat
+    Uint32 texture_format;
+    int path;
+    const char *name;
+} FormatPath;
+
+// SDL的YV12只是U、V顺序和IYUV相反，FFmpeg没有对应的格式，yuv420p都用IYUV
+static const FormatPath format_paths[] = {
+    {AV_PIX_FMT_YUV420P, SDL_PIXELFORMAT_IYUV, PATH_DIRECT, "direct"},
+    {AV_PIX_FMT_YUVJ420P, SDL_PIXELFORMAT_IYUV, PATH_DIRECT, "direct"},
+    {AV_PIX_FMT_NV12, SDL_PIXELFORMAT_NV12, PATH_DIRECT, "direct"},
+    {AV_PIX_FMT_NV21, SDL_PIXELFORMAT_NV21, PATH_DIRECT, "direct"},
+    {AV_PIX_FMT_YUV422P, SDL_PIXELFORMAT_IYUV, PATH_CHROMA_ROWS, "chroma rows skipped"},
+    {AV_PIX_FMT_YUVJ422P, SDL_PIXELFORMAT_IYUV, PATH_CHROMA_ROWS, "chroma rows skipped"},
+    {AV_PIX_FMT_YUV444P, SDL_PIXELFORMAT_IYUV, PATH_CHROMA_HALVE, "chroma subsampled"},
+    {AV_PIX_FMT_YUVJ444P, SDL_PIXELFORMAT_IYUV, PATH_CHROMA_HALVE, "chroma subsampled"},
+    {AV_PIX_FMT_YUV420P10LE, SDL_PIXELFORMAT_IYUV, PATH_NARROW, "10->8 bit"},
+    {AV_PIX_FMT_P010LE, SDL_PIXELFORMAT_NV12, PATH_NARROW, "10->8 bit"},
+};
+static const FormatPath sws_path = {AV_PIX_FMT_NONE, SDL_PIXELFORMAT_IYUV, PATH_SWS, "sws_scale"};
+
+static const FormatPath *find_path(int format)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(format_paths) / sizeof(format_paths[0]); i++)
+        if (format_paths[i].format == format)
+            return &format_paths[i];
+    return &sws_path;
+}
+
+static const char *texture_format_name(Uint32 format)
+{
+    return format == SDL_PIXELFORMAT_IYUV ? "iyuv" : format == SDL_PIXELFORMAT_NV12 ? "nv12" : "nv21";
+}
+
+// 纹理内存里各plane的位置：IYUV是Y、U、V三个plane，U、V的pitch是Y的一半；NV12/NV21是Y加一个交织的UV plane
+static void texture_planes(Uint32 format, uint8_t *pixels, int pitch, int height, uint8_t *data[3],
+                           int linesize[3])
+{
+    data[0] = pixels;
+    linesize[0] = pitch;
+    data[1] = data[0] + (size_t)pitch * height;
+    if (format == SDL_PIXELFORMAT_IYUV)
+    {
+        linesize[1] = linesize[2] = (pitch + 1) / 2;
+        data[2] = data[1] + (size_t)linesize[1] * ((height + 1) / 2);
+    }
+    else
+    {
+        linesize[1] = 2 * ((pitch + 1) / 2);
+        linesize[2] = 0;
+        data[2] = NULL;
+    }
+}
+
+// 按path把画面拷贝/转换到dst的各个plane，dst的布局见texture_planes
+static int convert_frame(const FormatPath *fp, const AVFrame *frame, uint8_t *dst[3], const int dst_linesize[3],
+                         struct SwsContext **sws)
+{
+    int w = frame->width, h = frame->height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const int *ls = frame->linesize;
+    int shift = frame->format == AV_PIX_FMT_P010LE ? 8 : 2;
+
+    switch (fp->path)
+    {
+    case PATH_DIRECT:
+        av_image_copy_plane(dst[0], dst_linesize[0], frame->data[0], ls[0], w, h);
+        if (fp->texture_format != SDL_PIXELFORMAT_IYUV)
+        {
+            av_image_copy_plane(dst[1], dst_linesize[1], frame->data[1], ls[1], 2 * cw, ch);
+            return 0;
+        }
+        av_image_copy_plane(dst[1], dst_linesize[1], frame->data[1], ls[1], cw, ch);
+        av_image_copy_plane(dst[2], dst_linesize[2], frame->data[2], ls[2], cw, ch);
+        return 0;
+    case PATH_CHROMA_ROWS:
+        av_image_copy_plane(dst[0], dst_linesize[0], frame->data[0], ls[0], w, h);
+        av_image_copy_plane(dst[1], dst_linesize[1], frame->data[1], 2 * ls[1], cw, ch);
+        av_image_copy_plane(dst[2], dst_linesize[2], frame->data[2], 2 * ls[2], cw, ch);
+        return 0;
+    case PATH_CHROMA_HALVE:
+        av_image_copy_plane(dst[0], dst_linesize[0], frame->data[0], ls[0], w, h);
+        plane_halve_width(dst[1], dst_linesize[1], frame->data[1], 2 * ls[1], cw, ch);
+        plane_halve_width(dst[2], dst_linesize[2], frame->data[2], 2 * ls[2], cw, ch);
+        return 0;
+    case PATH_NARROW:
+        plane_narrow16(dst[0], dst_linesize[0], frame->data[0], ls[0], w, h, shift);
+        if (fp->texture_format != SDL_PIXELFORMAT_IYUV)
+        {
+            plane_narrow16(dst[1], dst_linesize[1], frame->data[1], ls[1], 2 * cw, ch, shift);
+            return 0;
+        }
+        plane_narrow16(dst[1], dst_linesize[1], frame->data[1], ls[1], cw, ch, shift);
+        plane_narrow16(dst[2], dst_linesize[2], frame->data[2], ls[2], cw, ch, shift);
+        return 0;
+    default:
+        *sws = sws_getCachedContext(*sws, w, h, frame->format, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL,
+                                    NULL);
+        if (!*sws)
+            return -1;
+        sws_scale(*sws, (const uint8_t *const *)frame->data, frame->linesize, 0, h, dst, dst_linesize);
+        return 0;
+    }
+}
+
+void video_texture_init(VideoTexture *vt, SDL_Renderer *renderer)
+{
+    memset(vt, 0, sizeof(*vt));
+    vt->renderer = renderer;
+    vt->pix_fmt = AV_PIX_FMT_NONE;
+}
+
+static int texture_resize(VideoTexture *vt, Uint32 format, int width, int height)
+{
+    if (vt->texture)
+        SDL_DestroyTexture(vt->texture);
+    vt->texture = SDL_CreateTexture(vt->renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!vt->texture)
+    {
+        fprintf(stderr, "无法创建纹理 - %s\n", SDL_GetError());
+        vt->width = vt->height = 0;
+        return -1;
+    }
+    vt->format = format;
+    vt->width = width;
+    vt->height = height;
+    vt->created++;
+    return 0;
+}
+
+// Lock之后直接转换进纹理内存，不经过中间缓冲
+static int texture_convert_locked(VideoTexture *vt, const FormatPath *fp, const AVFrame *frame)
+{
+    uint8_t *data[3];
+    int linesize[3], ret;
+    void *pixels;
+    int pitch;
+
+    if (SDL_LockTexture(vt->texture, NULL, &pixels, &pitch) < 0)
+        return -1;
+    texture_planes(vt->format, pixels, pitch, vt->height, data, linesize);
+    ret = convert_frame(fp, frame, data, linesize, &vt->sws);
+    SDL_UnlockTexture(vt->texture);
+    return ret;
+}
+
+int video_texture_upload(VideoTexture *vt, const AVFrame *frame)
+{
+    const FormatPath *fp = find_path(frame->format);
+    const int *ls = frame->linesize;
+    int64_t t0;
+    int ret;
+
+    if ((!vt->texture || fp->texture_format != vt->format || frame->width != vt->width ||
+         frame->height != vt->height) &&
+        texture_resize(vt, fp->texture_format, frame->width, frame->height) < 0)
+        return -1;
+    vt->pix_fmt = frame->format;
+    vt->path = fp->name;
+
+    t0 = av_gettime_relative();
+    // 只有SDL能直接读的格式才能走update，其余的都Lock后转换
+    if (!vt->lock && fp->path == PATH_DIRECT && fp->texture_format != SDL_PIXELFORMAT_IYUV)
+        ret = SDL_UpdateNVTexture(vt->texture, NULL, frame->data[0], ls[0], frame->data[1], ls[1]);
+    else if (!vt->lock && (fp->path == PATH_DIRECT || fp->path == PATH_CHROMA_ROWS))
+    {
+        int chroma_step = fp->path == PATH_CHROMA_ROWS ? 2 : 1;
+        ret = SDL_UpdateYUVTexture(vt->texture, NULL,
+                                   frame->data[0], ls[0],
+                                   frame->data[1], ls[1] * chroma_step,
+                                   frame->data[2], ls[2] * chroma_step);
+    }
+    else
+        ret = texture_convert_locked(vt, fp, frame);
+    vt->upload_us += av_gettime_relative() - t0;
+    vt->uploads++;
+    return ret;
+}
+
+void video_texture_print_stats(const VideoTexture *vt)
+{
+    const char *name = av_get_pix_fmt_name(vt->pix_fmt);
+
+    if (!vt->uploads)
+        return;
+    printf("texture upload (%s, %s %s): %dx%d, %" PRId64 " frames, %.3f ms/frame, %" PRId64 " textures created\n",
+           vt->lock ? "lock" : "update", name ? name : "?", vt->path, vt->width, vt->height, vt->uploads,
+           vt->upload_us / 1000.0 / vt->uploads, vt->created);
+}
+
+void video_texture_destroy(VideoTexture *vt)
+{
+    if (vt->texture)
+        SDL_DestroyTexture(vt->texture);
+    vt->texture = NULL;
+    sws_freeContext(vt->sws);
+    vt->sws = NULL;
+}
+
+// 测试用的画面，内容随机
+static AVFrame *bench_frame(int format, int width, int height)
+{
+    AVFrame *frame = av_frame_alloc();
+    int i;
+    size_t j;
+
+    if (!frame)
+        return NULL;
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0)
+    {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    for (i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        for (j = 0; j < frame->buf[i]->size; j++)
+            frame->buf[i]->data[j] = rand();
+    return frame;
+}
+
+static const int bench_formats[] = {
+    AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12,        AV_PIX_FMT_NV21,   AV_PIX_FMT_YUV422P,
+    AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_P010LE, AV_PIX_FMT_RGB24,
+};
+
+// upload只算上传调用本身；有的后端真正的传输推迟到RenderCopy/Present，所以另外给出整轮的耗时
+static void bench_one(SDL_Renderer *renderer, const AVFrame *frame, int lock, int iterations)
+{
+    VideoTexture vt;
+    int64_t t0;
+    int i;
+
+    video_texture_init(&vt, renderer);
+    vt.lock = lock;
+    // 先传一次，把纹理创建和驱动的首次分配排除在外
+    if (video_texture_upload(&vt, frame) < 0)
+    {
+        video_texture_destroy(&vt);
+        return;
+    }
+    vt.uploads = vt.upload_us = 0;
+
+    t0 = av_gettime_relative();
+    for (i = 0; i < iterations; i++)
+    {
+        video_texture_upload(&vt, frame);
+        SDL_RenderCopy(renderer, vt.texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+    }
+    printf("%4dx%-4d %-12s %-6s %-20s upload %7.3f ms/frame   upload+present %7.3f ms/frame\n", frame->width,
+           frame->height, av_get_pix_fmt_name(frame->format), lock ? "lock" : "update", vt.path,
+           vt.upload_us / 1000.0 / iterations, (av_gettime_relative() - t0) / 1000.0 / iterations);
+    video_texture_destroy(&vt);
+}
+
+void video_texture_bench(int iterations)
+{
+    static const int sizes[][2] = {{1920, 1080}, {3840, 2160}};
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    SDL_RendererInfo info;
+    AVFrame *frame;
+    size_t i;
+
+    if (SDL_Init(SDL_INIT_VIDEO))
+    {
+        fprintf(stderr, "无法初始化SDL - %s\n", SDL_GetError());
+        return;
+    }
+    window = SDL_CreateWindow("bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 720, 560, SDL_WINDOW_HIDDEN);
+    // 不开垂直同步，Present不会等显示器刷新
+    renderer = window ? SDL_CreateRenderer(window, -1, 0) : NULL;
+    if (!renderer)
+    {
+        fprintf(stderr, "无法创建渲染器 - %s\n", SDL_GetError());
+        SDL_Quit();
+        return;
+    }
+    if (SDL_GetRendererInfo(renderer, &info) == 0)
+        printf("renderer: %s\n", info.name);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        // 4K每帧数据是1080p的4倍，次数减少到1/4，总时间差不多
+        int n = i == 0 ? iterations : iterations / 4 + 1;
+
+        if (!(frame = bench_frame(AV_PIX_FMT_YUV420P, sizes[i][0], sizes[i][1])))
+            break;
+        bench_one(renderer, frame, 0, n);
+        bench_one(renderer, frame, 1, n);
+        av_frame_free(&frame);
+    }
+
+    // 1080p下每种格式走各自的上传路径
+    for (i = 1; i < sizeof(bench_formats) / sizeof(bench_formats[0]); i++)
+    {
+        if (!(frame = bench_frame(bench_formats[i], 1920, 1080)))
+            continue;
+        bench_one(renderer, frame, 0, iterations);
+        av_frame_free(&frame);
+    }
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+void video_texture_bench_convert(int iterations)
+{
+    const int width = 1920, height = 1080;
+    uint8_t *buf = av_malloc((size_t)width * height * 3 / 2);
+    uint8_t *data[3];
+    int linesize[3];
+    size_t i;
+
+    if (!buf)
+        return;
+    for (i = 0; i < sizeof(bench_formats) / sizeof(bench_formats[0]); i++)
+    {
+        const FormatPath *fp = find_path(bench_formats[i]);
+        struct SwsContext *sws = NULL;
+        AVFrame *frame = bench_frame(bench_formats[i], width, height);
+        int64_t t0, t1, t2;
+        int j;
+
+        if (!frame)
+            continue;
+        // 和Lock出来的纹理内存一样的布局
+        texture_planes(fp->texture_format, buf, width, height, data, linesize);
+        t0 = av_gettime_relative();
+        for (j = 0; j < iterations; j++)
+            convert_frame(fp, frame, data, linesize, &sws);
+        t1 = av_gettime_relative();
+        // 对比：整帧sws_scale成yuv420p
+        texture_planes(SDL_PIXELFORMAT_IYUV, buf, width, height, data, linesize);
+        for (j = 0; j < iterations; j++)
+            convert_frame(&sws_path, frame, data, linesize, &sws);
+        t2 = av_gettime_relative();
+
+#define MPIX(us) ((double)iterations * width * height / ((us) > 0 ? (us) : 1))
+        printf("%-12s -> %-4s %-20s %7.3f ms/frame %8.1f Mpix/s   sws_scale %7.3f ms/frame %8.1f Mpix/s  %5.1fx\n",
+               av_get_pix_fmt_name(bench_formats[i]), texture_format_name(fp->texture_format),
+               fp->name, (t1 - t0) / 1000.0 / iterations, MPIX(t1 - t0), (t2 - t1) / 1000.0 / iterations,
+               MPIX(t2 - t1), (double)(t2 - t1) / (t1 - t0 > 0 ? t1 - t0 : 1));
+#undef MPIX
+        sws_freeContext(sws);
+        av_frame_free(&frame);
+    }
+    av_free(buf);
+}
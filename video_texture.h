@@ -0,0 +1,75 @@
+// video_texture.h
+// 播放器共用的纹理上传：纹理按画面尺寸和格式创建，第一帧、分辨率或者格式变化时重建，不再固定640x480/720x560。
+//
+// 按画面格式选最便宜的上传方式：
+//   yuv420p/nv12/nv21: SDL直接支持(IYUV/NV12/NV21纹理)，不做转换。SDL的YV12只是U、V顺序相反，yuv420p用IYUV就够了
+//   yuv422p:           色度隔行取成420，update方式下只是把色度的linesize乘2，不用拷贝
+//   yuv444p:           色度隔行隔列取(plane_halve_width)
+//   yuv420p10le/p010le: SIMD右移收窄成8位(plane_narrow16)，分别上传到IYUV/NV12纹理
+//   其他格式:          sws_scale成yuv420p
+// 需要转换的格式都是SDL_LockTexture之后直接写进纹理内存，不经过中间缓冲。
+//
+// SDL直接支持的格式有两种上传方式：
+//   update: SDL_UpdateYUVTexture/SDL_UpdateNVTexture直接从画面的plane上传；
+//   lock:   SDL_LockTexture拿到纹理内存，把plane拷进去再Unlock。
+// 哪种更快看渲染后端(OpenGL的streaming纹理有一份影子缓冲，Lock要多拷一次；D3D/Metal两种都经过staging)，
+// 用video_texture_bench在1080p和4K下实测；各格式转换本身的吞吐用video_texture_bench_convert测，不需要显示。
+//
+// 没有把解码器的get_buffer2直接指向SDL_LockTexture的内存：纹理只能在渲染线程里Lock，同一时间只能Lock一次，
+// Unlock之后内存就不归我们了，而解码器还要拿画面当参考帧、pictq里也要排几帧，生命周期对不上。
+//
+// 用法：
+//
+//   VideoTexture vt;
+//   video_texture_init(&vt, renderer);
+//   video_texture_upload(&vt, frame);
+//   SDL_RenderCopy(renderer, vt.texture, NULL, NULL);
+//   ...
+//   video_texture_destroy(&vt);
+
+#ifndef VIDEO_TEXTURE_H
+#define VIDEO_TEXTURE_H
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AVFrame;
+struct SwsContext;
+
+typedef struct VideoTexture
+{
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    Uint32 format; // 纹理格式，SDL_PIXELFORMAT_IYUV/NV12/NV21
+    int width, height;
+    int lock; // 1: lock方式，0: update方式
+    struct SwsContext *sws; // 没有专门路径的格式才用
+
+    // 最近一帧的格式(enum AVPixelFormat)和上传方式，打印统计用
+    int pix_fmt;
+    const char *path;
+
+    // 上传次数、上传累计耗时(微秒)、纹理创建次数
+    int64_t uploads, upload_us, created;
+} VideoTexture;
+
+void video_texture_init(VideoTexture *vt, SDL_Renderer *renderer);
+// 上传一帧画面，尺寸或格式和纹理不一致时先重建纹理。失败返回负数
+int video_texture_upload(VideoTexture *vt, const struct AVFrame *frame);
+void video_texture_print_stats(const VideoTexture *vt);
+void video_texture_destroy(VideoTexture *vt);
+
+// 用隐藏窗口在1080p和4K下比较两种上传方式，再在1080p下测每种格式的上传，打印每帧耗时
+void video_texture_bench(int iterations);
+// 1080p下每种格式转换到纹理布局的耗时和吞吐，和整帧sws_scale对比
+void video_texture_bench_convert(int iterations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
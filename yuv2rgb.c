@@ -0,0 +1,305 @@
+// yuv2rgb.c
+// yuv420p -> RGB24 转换内核，说明见yuv2rgb.h
+
+#include "yuv2rgb.h"
+
+#include <libavutil/cpu.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+static inline uint8_t clip_u8(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline void yuv_to_rgb(int y, int u, int v, uint8_t *rgb)
+{
+    int c = 298 * (y - 16) + 128;
+
+    u -= 128;
+    v -= 128;
+    rgb[0] = clip_u8((c + 409 * v) >> 8);
+    rgb[1] = clip_u8((c - 100 * u - 208 * v) >> 8);
+    rgb[2] = clip_u8((c + 516 * u) >> 8);
+}
+
+static void row_c(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, int x, int width)
+{
+    for (; x < width; x++)
+        yuv_to_rgb(y[x], u[x >> 1], v[x >> 1], dst + 3 * x);
+}
+
+void yuv420p_to_rgb24_c(const uint8_t *const src[3], const int src_stride[3],
+                        uint8_t *dst, int dst_stride, int width, int height)
+{
+    int j;
+
+    for (j = 0; j < height; j++)
+        row_c(src[0] + j * src_stride[0], src[1] + (j >> 1) * src_stride[1], src[2] + (j >> 1) * src_stride[2],
+              dst + j * dst_stride, 0, width);
+}
+
+#if HAVE_X86_SIMD
+
+// 每个32位通道是一对int16(低16位乘a，高16位乘b)，给pmaddwd用
+#define COEF_PAIR(a, b) ((int)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+// 16个像素的R/G/B交织成48字节RGB24：每个输出块用pshufb从三个分量里各挑字节再或起来，-1的位置填0
+static const int8_t rgb24_shuffle[3][3][16] = {
+    {
+        {0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+        {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+        {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1},
+    },
+    {
+        {-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+        {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+        {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1},
+    },
+    {
+        {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+        {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+        {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15},
+    },
+};
+
+__attribute__((target("sse4.1"))) static inline void store_rgb24_sse4(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+    int k;
+
+    for (k = 0; k < 3; k++)
+    {
+        __m128i out = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(r, _mm_loadu_si128((const __m128i *)rgb24_shuffle[k][0])),
+                         _mm_shuffle_epi8(g, _mm_loadu_si128((const __m128i *)rgb24_shuffle[k][1]))),
+            _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)rgb24_shuffle[k][2])));
+        _mm_storeu_si128((__m128i *)(dst + 16 * k), out);
+    }
+}
+
+// 8个像素一个分量：y16/c16是减过偏移的int16，配对后pmaddwd得到精确的32位结果，再+128、>>8、饱和打包
+__attribute__((target("sse4.1"))) static inline __m128i channel_sse4(__m128i y16, __m128i c16, __m128i coef)
+{
+    const __m128i round = _mm_set1_epi32(128);
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(y16, c16), coef);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(y16, c16), coef);
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+    return _mm_packs_epi32(lo, hi);
+}
+
+__attribute__((target("sse4.1"))) static inline __m128i green_sse4(__m128i y16, __m128i u16, __m128i v16)
+{
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i k_yu = _mm_set1_epi32(COEF_PAIR(298, -100));
+    const __m128i k_yv = _mm_set1_epi32(COEF_PAIR(0, -208));
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y16, u16), k_yu),
+                               _mm_madd_epi16(_mm_unpacklo_epi16(y16, v16), k_yv));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(y16, u16), k_yu),
+                               _mm_madd_epi16(_mm_unpackhi_epi16(y16, v16), k_yv));
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+    return _mm_packs_epi32(lo, hi);
+}
+
+__attribute__((target("sse4.1"))) static void row_sse4(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                                       uint8_t *dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_off = _mm_set1_epi16(16);
+    const __m128i uv_off = _mm_set1_epi16(128);
+    const __m128i k_r = _mm_set1_epi32(COEF_PAIR(298, 409));
+    const __m128i k_b = _mm_set1_epi32(COEF_PAIR(298, 516));
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+        __m128i yy = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i uu = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+        __m128i vv = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+        __m128i y_lo, y_hi, u_lo, u_hi, v_lo, v_hi, r, g, b;
+
+        // 色度每个样本复制给相邻两个像素
+        uu = _mm_unpacklo_epi8(uu, uu);
+        vv = _mm_unpacklo_epi8(vv, vv);
+
+        y_lo = _mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), y_off);
+        y_hi = _mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), y_off);
+        u_lo = _mm_sub_epi16(_mm_unpacklo_epi8(uu, zero), uv_off);
+        u_hi = _mm_sub_epi16(_mm_unpackhi_epi8(uu, zero), uv_off);
+        v_lo = _mm_sub_epi16(_mm_unpacklo_epi8(vv, zero), uv_off);
+        v_hi = _mm_sub_epi16(_mm_unpackhi_epi8(vv, zero), uv_off);
+
+        r = _mm_packus_epi16(channel_sse4(y_lo, v_lo, k_r), channel_sse4(y_hi, v_hi, k_r));
+        g = _mm_packus_epi16(green_sse4(y_lo, u_lo, v_lo), green_sse4(y_hi, u_hi, v_hi));
+        b = _mm_packus_epi16(channel_sse4(y_lo, u_lo, k_b), channel_sse4(y_hi, u_hi, k_b));
+        store_rgb24_sse4(dst + 3 * x, r, g, b);
+    }
+    row_c(y, u, v, dst, x, width);
+}
+
+__attribute__((target("sse4.1"))) static void frame_sse4(const uint8_t *const src[3], const int src_stride[3],
+                                                         uint8_t *dst, int dst_stride, int width, int height)
+{
+    int j;
+
+    for (j = 0; j < height; j++)
+        row_sse4(src[0] + j * src_stride[0], src[1] + (j >> 1) * src_stride[1], src[2] + (j >> 1) * src_stride[2],
+                 dst + j * dst_stride, width);
+}
+
+// 16个像素一个分量。unpack和pack都在128位lane内进行，两次lane内乱序正好抵消，结果还是像素顺序
+__attribute__((target("avx2"))) static inline __m256i channel_avx2(__m256i y16, __m256i c16, __m256i coef)
+{
+    const __m256i round = _mm256_set1_epi32(128);
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y16, c16), coef);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y16, c16), coef);
+
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 8);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 8);
+    return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2"))) static inline __m256i green_avx2(__m256i y16, __m256i u16, __m256i v16)
+{
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i k_yu = _mm256_set1_epi32(COEF_PAIR(298, -100));
+    const __m256i k_yv = _mm256_set1_epi32(COEF_PAIR(0, -208));
+    __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(y16, u16), k_yu),
+                                  _mm256_madd_epi16(_mm256_unpacklo_epi16(y16, v16), k_yv));
+    __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(y16, u16), k_yu),
+                                  _mm256_madd_epi16(_mm256_unpackhi_epi16(y16, v16), k_yv));
+
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 8);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 8);
+    return _mm256_packs_epi32(lo, hi);
+}
+
+// 两组16像素的int16打包成32个u8，packus在lane内交错，用permute4x64把四个64位块换回顺序
+__attribute__((target("avx2"))) static inline __m256i pack_u8_avx2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+__attribute__((target("avx2"))) static void row_avx2(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                                                     uint8_t *dst, int width)
+{
+    const __m256i y_off = _mm256_set1_epi16(16);
+    const __m256i uv_off = _mm256_set1_epi16(128);
+    const __m256i k_r = _mm256_set1_epi32(COEF_PAIR(298, 409));
+    const __m256i k_b = _mm256_set1_epi32(COEF_PAIR(298, 516));
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32)
+    {
+        __m128i uu = _mm_loadu_si128((const __m128i *)(u + x / 2));
+        __m128i vv = _mm_loadu_si128((const __m128i *)(v + x / 2));
+        __m256i y_a = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x))), y_off);
+        __m256i y_b = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(y + x + 16))), y_off);
+        __m256i u_a = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(uu, uu)), uv_off);
+        __m256i u_b = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(uu, uu)), uv_off);
+        __m256i v_a = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(vv, vv)), uv_off);
+        __m256i v_b = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(vv, vv)), uv_off);
+        __m256i r, g, b;
+
+        r = pack_u8_avx2(channel_avx2(y_a, v_a, k_r), channel_avx2(y_b, v_b, k_r));
+        g = pack_u8_avx2(green_avx2(y_a, u_a, v_a), green_avx2(y_b, u_b, v_b));
+        b = pack_u8_avx2(channel_avx2(y_a, u_a, k_b), channel_avx2(y_b, u_b, k_b));
+
+        store_rgb24_sse4(dst + 3 * x, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+                         _mm256_castsi256_si128(b));
+        store_rgb24_sse4(dst + 3 * x + 48, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                         _mm256_extracti128_si256(b, 1));
+    }
+    row_c(y, u, v, dst, x, width);
+}
+
+__attribute__((target("avx2"))) static void frame_avx2(const uint8_t *const src[3], const int src_stride[3],
+                                                       uint8_t *dst, int dst_stride, int width, int height)
+{
+    int j;
+
+    for (j = 0; j < height; j++)
+        row_avx2(src[0] + j * src_stride[0], src[1] + (j >> 1) * src_stride[1], src[2] + (j >> 1) * src_stride[2],
+                 dst + j * dst_stride, width);
+}
+
+#endif
+
+Yuv2RgbFunc yuv420p_to_rgb24_sse4(void)
+{
+#if HAVE_X86_SIMD
+    if (av_get_cpu_flags() & AV_CPU_FLAG_SSE4)
+        return frame_sse4;
+#endif
+    return NULL;
+}
+
+Yuv2RgbFunc yuv420p_to_rgb24_avx2(void)
+{
+#if HAVE_X86_SIMD
+    if (av_get_cpu_flags() & AV_CPU_FLAG_AVX2)
+        return frame_avx2;
+#endif
+    return NULL;
+}
+
+Yuv2RgbFunc yuv2rgb_select(const char **name)
+{
+    Yuv2RgbFunc fn;
+    const char *impl = "c";
+
+    if ((fn = yuv420p_to_rgb24_avx2()))
+        impl = "avx2";
+    else if ((fn = yuv420p_to_rgb24_sse4()))
+        impl = "sse4";
+    else
+        fn = yuv420p_to_rgb24_c;
+
+    if (name)
+        *name = impl;
+    return fn;
+}
+
+static int reference_channel(double v)
+{
+    return v <= 0 ? 0 : v >= 255 ? 255 : (int)(v + 0.5);
+}
+
+int yuv2rgb_reference_max_error(void)
+{
+    // BT.601: Kr = 0.299, Kb = 0.114，limited range的Y是[16, 235]，UV是[16, 240]
+    const double ky = 255.0 / 219.0;
+    const double kc = 255.0 / 112.0;
+    const double kr = 0.299, kb = 0.114, kg = 1.0 - kr - kb;
+    int y, u, v, c, max_err = 0;
+    uint8_t rgb[3];
+
+    for (y = 0; y < 256; y++)
+        for (u = 0; u < 256; u++)
+            for (v = 0; v < 256; v++)
+            {
+                double yy = ky * (y - 16), uu = kc * (u - 128), vv = kc * (v - 128);
+                int ref[3] = {
+                    reference_channel(yy + (1 - kr) * vv),
+                    reference_channel(yy - (1 - kb) * kb / kg * uu - (1 - kr) * kr / kg * vv),
+                    reference_channel(yy + (1 - kb) * uu),
+                };
+
+                yuv_to_rgb(y, u, v, rgb);
+                for (c = 0; c < 3; c++)
+                {
+                    int err = rgb[c] > ref[c] ? rgb[c] - ref[c] : ref[c] - rgb[c];
+                    if (err > max_err)
+                        max_err = err;
+                }
+            }
+    return max_err;
+}
@@ -0,0 +1,41 @@
+// yuv2rgb.h
+// yuv420p -> RGB24 的内置转换内核，有AVX2/SSE4.1/C三个版本，运行时按CPU特性选择。
+//
+// 公式是BT.601 limited range的8位定点版本(和sws_getContext默认的系数一致)：
+//
+//   R = clip((298 * (Y - 16) + 409 * (V - 128) + 128) >> 8)
+//   G = clip((298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128) + 128) >> 8)
+//   B = clip((298 * (Y - 16) + 516 * (U - 128) + 128) >> 8)
+//
+// 色度取最近邻(每个UV样本对应2x2个像素)。三个版本都是同样的整数运算，输出逐字节一致；
+// 和浮点的BT.601参考公式相比，每个分量的误差不超过1(yuv2rgb_reference_max_error可以穷举验证)。
+
+#ifndef YUV2RGB_H
+#define YUV2RGB_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*Yuv2RgbFunc)(const uint8_t *const src[3], const int src_stride[3],
+                            uint8_t *dst, int dst_stride, int width, int height);
+
+void yuv420p_to_rgb24_c(const uint8_t *const src[3], const int src_stride[3],
+                        uint8_t *dst, int dst_stride, int width, int height);
+// 当前CPU不支持或者不是x86时返回NULL
+Yuv2RgbFunc yuv420p_to_rgb24_sse4(void);
+Yuv2RgbFunc yuv420p_to_rgb24_avx2(void);
+
+// 按CPU特性选最快的版本，name返回版本名(可以传NULL)
+Yuv2RgbFunc yuv2rgb_select(const char **name);
+
+// 穷举所有YUV组合，返回定点公式和浮点参考公式之间最大的分量误差
+int yuv2rgb_reference_max_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif